@@ -33,6 +33,15 @@ namespace NanoLogConfig {
     // Number of threads that will push() data into into the StagingBuffer.
     constexpr int BENCHMARK_THREADS = 2;
 
+    // Number of producer threads used when benchmarking multiple consumers
+    constexpr int MULTI_CONSUMER_PRODUCERS = 64;
+
+    // Number of short-lived threads created by the thread churn benchmark
+    // and the number of data items each one push()-es before exiting.
+    // At most BENCHMARK_THREADS of them are alive at once.
+    constexpr int CHURN_THREADS = 1000;
+    constexpr int CHURN_PUSHES_PER_THREAD = 1000;
+
     // The datum that will be push()-ed into the StagingBuffer
     constexpr const char *datum = "123456789012345";
 
@@ -44,11 +53,109 @@ namespace NanoLogConfig {
     // thread. This value should be large enough to handle bursts of activity.
     static const uint32_t STAGING_BUFFER_SIZE = 1<<20;
 
+    // Size of the pieces a SegmentedStagingBuffer is built from and the
+    // upper bound on the memory the shared pool of them may occupy.
+    static const uint32_t SEGMENT_SIZE = 1<<16;
+    static const uint64_t SEGMENT_POOL_MAX_BYTES = 1UL<<28;
+
+    // Shape of the bursty workload: each producer push()-es BURST_BYTES
+    // worth of data as fast as it can and then idles for BURST_IDLE_US,
+    // NUM_BURSTS times over.
+    static const uint32_t BURST_BYTES = STAGING_BUFFER_SIZE*4;
+    static const uint32_t BURST_IDLE_US = 1000;
+    static const int NUM_BURSTS = 16;
+
+    // Size of each per-CPU buffer shared by all the threads running on a
+    // core; must be a power of 2.
+    static const uint32_t PER_CPU_BUFFER_SIZE = 1<<20;
+
+    // Number of unpinned threads in the per-CPU vs. per-thread buffer
+    // benchmark and the number of data items each one push()-es.
+    constexpr int PER_CPU_THREADS = 1000;
+    constexpr int PER_CPU_PUSHES_PER_THREAD = 1000;
+
+    // Largest number of reserveProducerSpace() regions that may be
+    // outstanding at once in a locked StagingBuffer shared by producers
+    constexpr int MAX_RESERVATIONS = 64;
+
+    // Records at least this large are copied into the StagingBuffer with
+    // non-temporal stores so they don't evict the producer's working set.
+    static const uint32_t NON_TEMPORAL_THRESHOLD = 1024;
+
+    // Shape of the large record benchmark: each producer pushes
+    // LARGE_RECORD_PUSHES records of LARGE_RECORD_SIZE bytes and walks
+    // through a private working set of PRODUCER_WORKING_SET bytes between
+    // pushes.
+    static const uint32_t LARGE_RECORD_SIZE = 4096;
+    constexpr int LARGE_RECORD_PUSHES = 100000;
+    static const uint32_t PRODUCER_WORKING_SET = 16*1024;
+
+    // Default distances for the prefetching consumer: how many buffers
+    // ahead to prefetch the StagingBuffer control variables and how many
+    // cache lines ahead to prefetch the data being consumed.
+    constexpr int PREFETCH_BUFFER_DISTANCE = 1;
+    constexpr int PREFETCH_LINE_DISTANCE = 4;
+
+    // Default triggers for the lazily publishing producer: it exposes its
+    // records to the consumer after this many records, this many bytes or
+    // once the oldest unpublished record is this many nanoseconds old,
+    // whichever comes first. 0 disables a trigger.
+    static const uint32_t LAZY_PUBLISH_RECORDS = 64;
+    static const uint32_t LAZY_PUBLISH_BYTES = 4096;
+    static const uint32_t LAZY_PUBLISH_DEADLINE_NS = 1000;
+
+    // Number of slots the FastForwardQueue's producer and consumer probe
+    // ahead, which keeps them at least that far apart when the queue is
+    // nearly full or empty
+    static const uint32_t FAST_FORWARD_BATCH_SLOTS = 32;
+
+    // Length of each run of the lock fairness benchmark, in which every
+    // producer push()-es into one shared buffer as fast as it can, and the
+    // largest number of producers it's run with.
+    static const uint32_t FAIRNESS_DURATION_MS = 100;
+    constexpr int FAIRNESS_MAX_THREADS = 32;
+
+    // Number of producer threads that get a request slot in a single
+    // flat-combining buffer over its lifetime; the rest bypass combining
+    constexpr int FLAT_COMBINING_SLOTS = 64;
+
+    // Number of producers in the hierarchical aggregation benchmark and
+    // the largest number of bytes an aggregator moves out of a producer's
+    // StagingBuffer in one copy.
+    constexpr int HIERARCHY_PRODUCERS = 128;
+    static const uint32_t AGGREGATION_BATCH_BYTES = 64*1024;
+
+    // Size of an aggregator's node-local ring, which takes in the entries
+    // of all the producers on its node rather than of a single thread
+    static const uint32_t AGGREGATION_RING_SIZE = 1<<24;
+
+    // Shape of the hybrid registry: the number of shared MPSC buffers the
+    // threads without a dedicated StagingBuffer log into, the largest number
+    // of dedicated StagingBuffers alive at once, and the push rate (pushes
+    // per window) at which a thread is promoted to a dedicated buffer.
+    static const uint32_t HYBRID_SHARED_BUFFERS = 4;
+    constexpr int HYBRID_DEDICATED_BUFFERS = 32;
+    static const uint32_t HYBRID_PROMOTE_PUSHES = 1000;
+    static const uint32_t HYBRID_PROMOTION_WINDOW_US = 1000;
+
+    // Workload of the hybrid registry benchmark: every HYBRID_HOT_STRIDE-th
+    // thread is hot and push()-es HYBRID_HOT_PUSHES items back to back; the
+    // rest push HYBRID_COLD_PUSHES items HYBRID_COLD_GAP_NS apart.
+    constexpr int HYBRID_HOT_STRIDE = 16;
+    constexpr int HYBRID_HOT_PUSHES = 100000;
+    constexpr int HYBRID_COLD_PUSHES = 100;
+    static const uint32_t HYBRID_COLD_GAP_NS = 10000;
+
+    // Size of a cache line, used to keep variables written by different
+    // threads apart
+    static const uint32_t BYTES_PER_CACHE_LINE = 64;
 
-    /***
-     * Below are options that exist in real NanoLog but are unused in this repo.
-     * If you use any of the variables below; please move them above this line.
-     */
+    // The threshold at which the consumer should release space back to the
+    // producer in the thread-local StagingBuffer. Due to the blocking nature
+    // of the producer when it runs out of space, a low value will incur more
+    // more blocking but at a shorter duration, whereas a high value will have
+    // the opposite effect.
+    static const uint32_t RELEASE_THRESHOLD = STAGING_BUFFER_SIZE>>1;
 
     // Controls in what mode the compressed log file will be opened
     static const int FILE_PARAMS = O_APPEND|O_RDWR|O_CREAT|O_NOATIME|O_DSYNC;
@@ -67,12 +174,11 @@ namespace NanoLogConfig {
         "OUTPUT_BUFFER_SIZE must be greater than or "
             "equal to the STAGING_BUFFER_SIZE");
 
-    // The threshold at which the consumer should release space back to the
-    // producer in the thread-local StagingBuffer. Due to the blocking nature
-    // of the producer when it runs out of space, a low value will incur more
-    // more blocking but at a shorter duration, whereas a high value will have
-    // the opposite effect.
-    static const uint32_t RELEASE_THRESHOLD = STAGING_BUFFER_SIZE>>1;
+
+    /***
+     * Below are options that exist in real NanoLog but are unused in this repo.
+     * If you use any of the variables below; please move them above this line.
+     */
 
     // How often should the background compression thread wake up to check
     // for more log messages in the StagingBuffers to compress and output.
@@ -85,8 +191,6 @@ namespace NanoLogConfig {
     // to complete. Due to overheads in the kernel, this number will
     // be a lower bound and the actual time spent sleeping may be higher.
     static const uint32_t POLL_INTERVAL_DURING_IO_US = 1;
-
-    static const uint32_t BYTES_PER_CACHE_LINE = 64;
 }
 
 #endif /* CONFIG_H */
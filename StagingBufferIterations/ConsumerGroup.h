@@ -0,0 +1,194 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CONSUMERGROUP_H
+#define CONSUMERGROUP_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "Config.h"
+
+namespace Alternatives {
+
+/**
+ * Shards a set of single-producer/single-consumer StagingBuffers across
+ * multiple consumer threads. Each buffer has a home consumer that
+ * normally drains it, but a consumer that runs out of work will steal the
+ * buffer with the largest backlog from another consumer, moving the buffer
+ * into its own shard.
+ *
+ * To preserve the single consumer invariant of the StagingBuffers, a
+ * consumer must hold a buffer's busy flag while it peek()/consume()-s it.
+ * The flag is acquired/released with acquire/release semantics so that
+ * the consumer state of the buffer (i.e. consumerPos) is handed off
+ * cleanly when the buffer changes hands.
+ */
+template<typename Buffer>
+class ConsumerGroup {
+public:
+    /**
+     * ConsumerGroup constructor
+     *
+     * \param buffers
+     *      StagingBuffers to consume from
+     * \param numBuffers
+     *      Number of StagingBuffers in *buffers
+     * \param numConsumers
+     *      Number of consumer threads the buffers will be sharded across
+     */
+    ConsumerGroup(Buffer **buffers, int numBuffers, int numConsumers)
+        : slots(numBuffers)
+        , numSteals(0)
+    {
+        for (int i = 0; i < numBuffers; ++i) {
+            slots[i].buffer = buffers[i];
+            slots[i].owner = i % numConsumers;
+            slots[i].busy = false;
+        }
+    }
+
+    /**
+     * Makes one pass over the buffers in the consumer's shard, processing
+     * whatever is available in each.
+     *
+     * \param consumerId
+     *      Identifier of the consumer thread invoking the function
+     * \param process
+     *      Callable invoked as process(char *data, uint64_t bytes) on each
+     *      contiguous region peek()-ed. It returns the number of bytes it
+     *      processed, which will be consume()-ed.
+     * \return
+     *      Number of bytes consumed
+     */
+    template<typename Fn>
+    uint64_t
+    drain(int consumerId, Fn &&process)
+    {
+        uint64_t bytesConsumed = 0;
+        for (size_t i = 0; i < slots.size(); ++i) {
+            if (slots[i].owner.load(std::memory_order_relaxed) != consumerId)
+                continue;
+
+            bytesConsumed += drainSlot(slots[i], process);
+        }
+
+        return bytesConsumed;
+    }
+
+    /**
+     * Moves the buffer with the largest backlog from another consumer's
+     * shard into this consumer's shard and drains it. This should be
+     * invoked when a consumer finds no work in its own shard.
+     *
+     * \param consumerId
+     *      Identifier of the consumer thread invoking the function
+     * \param process
+     *      See drain()
+     * \return
+     *      Number of bytes consumed from the stolen buffer, 0 if nothing
+     *      was worth stealing
+     */
+    template<typename Fn>
+    uint64_t
+    steal(int consumerId, Fn &&process)
+    {
+        Slot *victim = nullptr;
+        uint64_t victimBacklog = MIN_STEAL_BYTES - 1;
+
+        for (size_t i = 0; i < slots.size(); ++i) {
+            int owner = slots[i].owner.load(std::memory_order_relaxed);
+            if (owner == consumerId)
+                continue;
+
+            uint64_t backlog = slots[i].buffer->getBytesPending();
+            if (backlog > victimBacklog) {
+                victim = &slots[i];
+                victimBacklog = backlog;
+            }
+        }
+
+        if (victim == nullptr)
+            return 0;
+
+        int owner = victim->owner.load(std::memory_order_relaxed);
+        if (!victim->owner.compare_exchange_strong(owner, consumerId))
+            return 0;
+
+        numSteals.fetch_add(1, std::memory_order_relaxed);
+        return drainSlot(*victim, process);
+    }
+
+    // Number of times a buffer moved between consumer shards
+    uint64_t
+    getNumSteals() {
+        return numSteals.load();
+    }
+
+private:
+    // Minimum backlog a buffer must have before it's worth stealing
+    static const uint64_t MIN_STEAL_BYTES =
+                                    NanoLogConfig::BYTES_PER_CACHE_LINE*16;
+
+    /**
+     * Per buffer ownership information. Aligned to a cache line so that
+     * consumers polling different buffers don't falsely share.
+     */
+    struct alignas(NanoLogConfig::BYTES_PER_CACHE_LINE) Slot {
+        // StagingBuffer being sharded
+        Buffer *buffer;
+
+        // Consumer whose shard the buffer currently belongs to
+        std::atomic<int> owner;
+
+        // True while a consumer is peek()/consume()-ing the buffer
+        std::atomic<bool> busy;
+    };
+
+    /**
+     * Drains a single buffer if no other consumer is currently in it.
+     */
+    template<typename Fn>
+    uint64_t
+    drainSlot(Slot &slot, Fn &process)
+    {
+        if (slot.busy.load(std::memory_order_relaxed) ||
+                slot.busy.exchange(true, std::memory_order_acquire))
+            return 0;
+
+        uint64_t bytesAvail;
+        char *data = slot.buffer->peek(&bytesAvail);
+
+        uint64_t bytesConsumed = 0;
+        if (bytesAvail > 0) {
+            bytesConsumed = process(data, bytesAvail);
+            slot.buffer->consume(bytesConsumed);
+        }
+
+        slot.busy.store(false, std::memory_order_release);
+        return bytesConsumed;
+    }
+
+    // Ownership information for every buffer in the group
+    std::vector<Slot> slots;
+
+    // Number of times a buffer moved between consumer shards
+    std::atomic<uint64_t> numSteals;
+};
+
+}; // namespace Alternatives
+
+#endif // CONSUMERGROUP_H
@@ -0,0 +1,341 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "Config.h"
+#include "Log.h"
+
+/**
+ * Offline reader for the log files produced by the compressing consumer in
+ * the benchmark. It mmaps the log file, locates the independently decodable
+ * chunks, decodes them in parallel and then merges the per-StagingBuffer
+ * streams by timestamp to produce a single time-ordered text log.
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static double
+secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/**
+ * Walks the log file and collects pointers to all the chunks within it.
+ *
+ * \param file
+ *      Beginning of the mmap-ed log file
+ * \param fileSize
+ *      Number of bytes in the log file
+ * \param[out] chunks
+ *      Chunks found in the file, in file order
+ * \param[out] cyclesPerSecond
+ *      Conversion factor for the timestamps found in the FileHeader
+ * \return
+ *      true if the file was well formed
+ */
+static bool
+indexChunks(const char *file, size_t fileSize,
+            std::vector<const Log::ChunkHeader*> &chunks,
+            double *cyclesPerSecond)
+{
+    const char *pos = file;
+    const char *end = file + fileSize;
+    *cyclesPerSecond = 0;
+
+    while (end - pos >= static_cast<ptrdiff_t>(sizeof(uint32_t))) {
+        uint32_t magic;
+        std::memcpy(&magic, pos, sizeof(magic));
+
+        // A log file appended to by multiple runs will contain multiple
+        // FileHeaders; the last one wins.
+        if (magic == Log::FILE_MAGIC &&
+                end - pos >= static_cast<ptrdiff_t>(sizeof(Log::FileHeader))) {
+            auto header = reinterpret_cast<const Log::FileHeader*>(pos);
+            *cyclesPerSecond = header->cyclesPerSecond;
+            pos += sizeof(Log::FileHeader);
+            continue;
+        }
+
+        if (magic != Log::CHUNK_MAGIC ||
+                end - pos < static_cast<ptrdiff_t>(sizeof(Log::ChunkHeader))) {
+            fprintf(stderr, "Corrupt log file at offset %lu\r\n", pos - file);
+            return false;
+        }
+
+        auto chunk = reinterpret_cast<const Log::ChunkHeader*>(pos);
+        pos += sizeof(Log::ChunkHeader) + chunk->length;
+        if (pos > end) {
+            fprintf(stderr, "Truncated chunk at offset %lu\r\n",
+                    reinterpret_cast<const char*>(chunk) - file);
+            return false;
+        }
+
+        chunks.push_back(chunk);
+    }
+
+    return *cyclesPerSecond > 0;
+}
+
+/**
+ * Decodes the chunks in parallel. Threads pull chunks off a shared
+ * counter so that uneven chunk sizes don't leave threads idle.
+ *
+ * \param chunks
+ *      Chunks to decode
+ * \param numThreads
+ *      Number of decoding threads to use
+ * \param[out] decoded
+ *      Decoded log messages, one vector per chunk
+ * \return
+ *      true if all chunks decoded successfully
+ */
+static bool
+decodeChunks(const std::vector<const Log::ChunkHeader*> &chunks,
+             int numThreads,
+             std::vector<std::vector<Log::DecodedEntry>> &decoded)
+{
+    std::atomic<size_t> nextChunk(0);
+    std::atomic<bool> success(true);
+    decoded.resize(chunks.size());
+
+    auto decoderMain = [&]() {
+        size_t i;
+        while ((i = nextChunk.fetch_add(1)) < chunks.size()) {
+            if (!Log::decodeChunk(chunks[i], decoded[i]))
+                success = false;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < numThreads; ++i)
+        threads.emplace_back(decoderMain);
+
+    decoderMain();
+    for (auto &thread : threads)
+        thread.join();
+
+    return success;
+}
+
+/**
+ * Cursor into the time-ordered stream of log messages from a single
+ * StagingBuffer. Chunks from the same StagingBuffer appear in the log file
+ * in the order they were produced, so concatenating them yields a sorted
+ * stream.
+ */
+struct Stream {
+    // Decoded chunks belonging to this StagingBuffer in file order
+    std::vector<const std::vector<Log::DecodedEntry>*> chunks;
+
+    // Current chunk and offset within it
+    size_t chunk;
+    size_t entry;
+
+    const Log::DecodedEntry &
+    head() const {
+        return (*chunks[chunk])[entry];
+    }
+
+    // Moves to the next entry; returns false if the stream is exhausted
+    bool
+    advance() {
+        if (++entry < chunks[chunk]->size())
+            return true;
+
+        entry = 0;
+        while (++chunk < chunks.size()) {
+            if (!chunks[chunk]->empty())
+                return true;
+        }
+
+        return false;
+    }
+};
+
+/**
+ * Performs a k-way merge across the per-StagingBuffer streams and writes
+ * the log messages out as text in timestamp order.
+ *
+ * \return
+ *      Number of log messages output
+ */
+static uint64_t
+mergeAndOutput(const std::vector<const Log::ChunkHeader*> &chunks,
+               const std::vector<std::vector<Log::DecodedEntry>> &decoded,
+               double cyclesPerSecond,
+               FILE *out)
+{
+    std::map<uint32_t, Stream> streams;
+    uint64_t firstTimestamp = UINT64_MAX;
+
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (decoded[i].empty())
+            continue;
+
+        Stream &stream = streams[chunks[i]->bufferId];
+        stream.chunks.push_back(&decoded[i]);
+        firstTimestamp = std::min(firstTimestamp, decoded[i][0].timestamp);
+    }
+
+    auto later = [](const Stream *a, const Stream *b) {
+        return a->head().timestamp > b->head().timestamp;
+    };
+    std::priority_queue<Stream*, std::vector<Stream*>, decltype(later)>
+            heap(later);
+
+    for (auto &it : streams) {
+        it.second.chunk = 0;
+        it.second.entry = 0;
+        heap.push(&it.second);
+    }
+
+    uint64_t numOutput = 0;
+    while (!heap.empty()) {
+        Stream *stream = heap.top();
+        heap.pop();
+
+        const Log::DecodedEntry &entry = stream->head();
+        double seconds = (entry.timestamp - firstTimestamp)/cyclesPerSecond;
+        fprintf(out, "%.9lf [Buffer %u]: %.*s\n",
+                seconds,
+                entry.bufferId,
+                static_cast<int>(strnlen(entry.argData, entry.argBytes)),
+                entry.argData);
+        ++numOutput;
+
+        if (stream->advance())
+            heap.push(stream);
+    }
+
+    return numOutput;
+}
+
+static void
+usage(const char *exec)
+{
+    printf("Usage: %s [-t <threads>] [-o <outputFile>] [logFile]\r\n"
+           "\r\n"
+           "Decompresses a log file produced by the benchmark's compressing\r\n"
+           "consumer into time-ordered text. The log file defaults to %s\r\n"
+           "and the output defaults to stdout.\r\n",
+           exec, NanoLogConfig::DEFAULT_LOG_FILE);
+}
+
+int main(int argc, char** argv) {
+    const char *logFile = NanoLogConfig::DEFAULT_LOG_FILE;
+    const char *outputFile = nullptr;
+    int numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:o:h")) != -1) {
+        switch (opt) {
+            case 't':
+                numThreads = std::max(1, atoi(optarg));
+                break;
+            case 'o':
+                outputFile = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? 0 : 1;
+        }
+    }
+
+    if (optind < argc)
+        logFile = argv[optind];
+
+    int fd = open(logFile, O_RDONLY);
+    if (fd < 0) {
+        perror("Unable to open log file");
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size == 0) {
+        fprintf(stderr, "Log file %s is empty\r\n", logFile);
+        close(fd);
+        return 1;
+    }
+
+    size_t fileSize = st.st_size;
+    void *map = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Unable to mmap log file");
+        return 1;
+    }
+    madvise(map, fileSize, MADV_WILLNEED);
+
+    FILE *out = stdout;
+    if (outputFile && !(out = fopen(outputFile, "w"))) {
+        perror("Unable to open output file");
+        return 1;
+    }
+
+    static char outputBuffer[1<<20];
+    setvbuf(out, outputBuffer, _IOFBF, sizeof(outputBuffer));
+
+    Clock::time_point start = Clock::now();
+
+    double cyclesPerSecond;
+    std::vector<const Log::ChunkHeader*> chunks;
+    if (!indexChunks(static_cast<const char*>(map), fileSize,
+                     chunks, &cyclesPerSecond))
+        return 1;
+
+    std::vector<std::vector<Log::DecodedEntry>> decoded;
+    if (!decodeChunks(chunks, numThreads, decoded)) {
+        fprintf(stderr, "Corrupt chunk encountered while decoding\r\n");
+        return 1;
+    }
+    double decodeTime = secondsSince(start);
+
+    uint64_t numEntries = mergeAndOutput(chunks, decoded,
+                                         cyclesPerSecond, out);
+    fflush(out);
+    double totalTime = secondsSince(start);
+
+    if (out != stdout)
+        fclose(out);
+    munmap(map, fileSize);
+
+    fprintf(stderr,
+            "# Decompressed %lu log messages (%0.3lf MB in %lu chunks) "
+            "using %d threads\r\n"
+            "# Decode: %0.3lf ms (%0.2lf MB/s, %0.2lf Mmsgs/s)\r\n"
+            "# Total with merge + output: %0.3lf ms (%0.2lf MB/s)\r\n",
+            numEntries, fileSize/1.0e6, chunks.size(), numThreads,
+            decodeTime*1.0e3,
+            fileSize/1.0e6/decodeTime, numEntries/1.0e6/decodeTime,
+            totalTime*1.0e3, fileSize/1.0e6/totalTime);
+
+    return 0;
+}
@@ -0,0 +1,186 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef DISRUPTORRING_H
+#define DISRUPTORRING_H
+
+#include <cassert>
+#include <cstdint>
+
+#include "Config.h"
+#include "Fence.h"
+
+namespace Alternatives {
+
+/**
+ * Ring of events in the style of the LMAX Disruptor, shared by a single
+ * producer and a chain of NumStages consumer stages. Instead of passing
+ * records from one queue to the next, every stage walks the same ring with
+ * its own sequence number and may only process the events that the stage
+ * before it (or, for the first stage, the producer) has released. Stages
+ * annotate the events in place for the stages after them, and the producer
+ * reuses an event only once the last, and thus slowest, stage is done
+ * with it.
+ *
+ * Sequences count events from the start of the ring's life and never wrap;
+ * the event for sequence s lives at index s & (NUM_EVENTS - 1).
+ *
+ * \tparam Event
+ *      Type of the ring's elements
+ * \tparam NumStages
+ *      Number of consumer stages, in processing order
+ */
+template<typename Event, int NumStages>
+class DisruptorRing {
+    static_assert(NumStages > 0, "a ring needs at least one stage");
+
+    // Largest power of two no greater than n
+    static constexpr uint64_t
+    floorPowerOfTwo(uint64_t n) {
+        return (n & (n - 1)) == 0 ? n : floorPowerOfTwo(n & (n - 1));
+    }
+
+public:
+    // Number of events in the ring; as many as fit in a StagingBuffer
+    static constexpr uint64_t NUM_EVENTS = floorPowerOfTwo(
+                    NanoLogConfig::STAGING_BUFFER_SIZE/sizeof(Event));
+    static_assert(NUM_EVENTS > 0, "Event is larger than a StagingBuffer");
+
+    explicit DisruptorRing(uint32_t id)
+        : claimSequence(0)
+        , cachedGatingSequence(0)
+        , published()
+        , stageSequences()
+        , id(id)
+        , events(new Event[NUM_EVENTS])
+    {
+    }
+
+    ~DisruptorRing() {
+        delete[] events;
+    }
+
+    DisruptorRing(const DisruptorRing&) = delete;
+    DisruptorRing& operator=(const DisruptorRing&) = delete;
+
+    /**
+     * Returns the producer's next event to fill in, spinning until the
+     * last stage has released it from the ring's previous lap. The event
+     * is invisible to the stages until publish().
+     */
+    inline Event *
+    claim() {
+        while (claimSequence - cachedGatingSequence >= NUM_EVENTS)
+            cachedGatingSequence = stageSequences[NumStages - 1].value;
+
+        return &events[claimSequence & (NUM_EVENTS - 1)];
+    }
+
+    /**
+     * Makes the event from the last claim() visible to the first stage.
+     */
+    inline void
+    publish() {
+        // Ensures the producer finishes writing the event before the bump
+        NanoLogInternal::Fence::sfence();
+        published.value = ++claimSequence;
+    }
+
+    /**
+     * Sequence barrier of a stage: returns the sequence up to which
+     * (exclusive) the events are ready for the stage to process.
+     *
+     * \param stage
+     *      Index of the stage in processing order
+     */
+    inline uint64_t
+    getAvailable(int stage) {
+        assert(stage >= 0 && stage < NumStages);
+        uint64_t available = (stage == 0) ? published.value
+                                          : stageSequences[stage - 1].value;
+
+        // Prevent reading the events before the sequence
+        NanoLogInternal::Fence::lfence();
+        return available;
+    }
+
+    // Sequence up to which (exclusive) the stage has released the events
+    inline uint64_t
+    getSequence(int stage) {
+        return stageSequences[stage].value;
+    }
+
+    /**
+     * Releases all the events before sequence to the next stage (or, for
+     * the last stage, back to the producer).
+     *
+     * \param stage
+     *      Index of the stage in processing order
+     * \param sequence
+     *      Sequence of the first event the stage has yet to process
+     */
+    inline void
+    release(int stage, uint64_t sequence) {
+        // Make sure the stage's reads and writes of the events finish
+        // before the bump
+        NanoLogInternal::Fence::lfence();
+        NanoLogInternal::Fence::sfence();
+        stageSequences[stage].value = sequence;
+    }
+
+    // Returns the event for a sequence the caller may access
+    inline Event &
+    get(uint64_t sequence) {
+        return events[sequence & (NUM_EVENTS - 1)];
+    }
+
+    uint32_t getId() {
+        return id;
+    }
+
+private:
+    // Sequence kept on its own cache line, since each one is written by a
+    // different thread
+    struct alignas(NanoLogConfig::BYTES_PER_CACHE_LINE) PaddedSequence {
+        volatile uint64_t value;
+
+        PaddedSequence()
+            : value(0)
+        {
+        }
+    };
+
+    // Sequence of the event the producer fills in next
+    uint64_t claimSequence;
+
+    // Producer's last read of the last stage's sequence
+    uint64_t cachedGatingSequence;
+
+    // Sequence up to which (exclusive) the producer has published events
+    PaddedSequence published;
+
+    // Sequence up to which (exclusive) each stage has released events
+    PaddedSequence stageSequences[NumStages];
+
+    // User-assigned identifier for this ring
+    uint32_t id;
+
+    // The events
+    Event *events;
+};
+
+}; // namespace Alternatives
+
+#endif // DISRUPTORRING_H
@@ -0,0 +1,184 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef FASTFORWARDQUEUE_H
+#define FASTFORWARDQUEUE_H
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include "Config.h"
+#include "Fence.h"
+
+namespace Alternatives {
+
+/**
+ * Single producer, single consumer queue of fixed-size records in the style
+ * of FastForward and B-Queue. Unlike the StagingBuffer, the producer and
+ * consumer never read each other's position: every slot carries a flag that
+ * the producer sets when it fills the slot and the consumer clears when it
+ * empties it, so the only shared cache lines are the slots themselves.
+ *
+ * To keep the two apart when the queue is nearly full or nearly empty, both
+ * sides probe BatchSlots ahead before touching a batch. Since slots are
+ * filled and emptied in order, an empty slot BatchSlots ahead of the
+ * producer means the whole batch is empty, and a full slot ahead of the
+ * consumer means everything before it is full. The consumer halves its
+ * probe distance when the probe fails (B-Queue's backtracking) so that it
+ * still drains a producer that has stopped mid-batch.
+ *
+ * \tparam SlotBytes
+ *      Size of every record
+ * \tparam BatchSlots
+ *      Probe distance in slots
+ */
+template<size_t SlotBytes,
+         uint32_t BatchSlots = NanoLogConfig::FAST_FORWARD_BATCH_SLOTS>
+class FastForwardQueue {
+public:
+    explicit FastForwardQueue(uint32_t id)
+        : producerIndex(0)
+        , producerBatchLeft(0)
+        , consumerIndex(0)
+        , consumerBatchLeft(0)
+        , id(id)
+        , slots()
+    {
+        static_assert(NUM_SLOTS >= BatchSlots,
+                      "the batch must fit in the queue");
+    }
+
+    /**
+     * Copies a record into the next slot and makes it visible to the
+     * consumer, spinning while the next batch of slots is still full.
+     *
+     * \param data
+     *      Record to copy in
+     * \param nbytes
+     *      Size of the record; must not exceed SlotBytes
+     * \return
+     *      true, for interchangeability with the StagingBuffers' push()
+     */
+    inline bool
+    push(const char *data, size_t nbytes) {
+        assert(nbytes <= SlotBytes);
+
+        while (producerBatchLeft == 0) {
+            if (!slots[(producerIndex + BatchSlots - 1) % NUM_SLOTS].full)
+                producerBatchLeft = BatchSlots;
+        }
+
+        Slot &slot = slots[producerIndex];
+        std::memcpy(slot.data, data, nbytes);
+
+        // Ensures the record is written before the flag
+        NanoLogInternal::Fence::sfence();
+        slot.full = 1;
+
+        --producerBatchLeft;
+        producerIndex = (producerIndex + 1) % NUM_SLOTS;
+        return true;
+    }
+
+    /**
+     * Returns the consumer's next record without removing it.
+     *
+     * \return
+     *      Pointer to SlotBytes of the record, or nullptr if there is none
+     */
+    inline const char *
+    front() {
+        if (consumerBatchLeft == 0) {
+            for (uint32_t probe = BatchSlots; probe > 0; probe /= 2) {
+                if (slots[(consumerIndex + probe - 1) % NUM_SLOTS].full) {
+                    consumerBatchLeft = probe;
+                    break;
+                }
+            }
+
+            if (consumerBatchLeft == 0)
+                return nullptr;
+
+            // Prevent reading the records before the flag
+            NanoLogInternal::Fence::lfence();
+        }
+
+        return slots[consumerIndex].data;
+    }
+
+    /**
+     * Releases the record returned by front() back to the producer.
+     */
+    inline void
+    pop() {
+        assert(consumerBatchLeft > 0);
+
+        // Make sure the consumer's reads finish before the slot is reused
+        NanoLogInternal::Fence::lfence();
+        slots[consumerIndex].full = 0;
+
+        --consumerBatchLeft;
+        consumerIndex = (consumerIndex + 1) % NUM_SLOTS;
+    }
+
+    uint32_t getId() {
+        return id;
+    }
+
+private:
+    struct Slot {
+        // 1 while the slot holds a record the consumer has yet to pop()
+        volatile uint32_t full;
+
+        // The record
+        char data[SlotBytes];
+
+        Slot()
+            : full(0)
+            , data()
+        {
+        }
+    };
+
+    // Number of slots that fit in a StagingBuffer's worth of memory
+    static constexpr uint32_t NUM_SLOTS =
+                            NanoLogConfig::STAGING_BUFFER_SIZE/sizeof(Slot);
+
+    // Next slot the producer will fill
+    uint32_t producerIndex;
+
+    // Number of slots starting at producerIndex known to be empty
+    uint32_t producerBatchLeft;
+
+    // Separates the producer's variables (above) from the consumer's
+    // (below)
+    alignas(NanoLogConfig::BYTES_PER_CACHE_LINE)
+    uint32_t consumerIndex;
+
+    // Number of slots starting at consumerIndex known to be full
+    uint32_t consumerBatchLeft;
+
+    // User-assigned identifier for this queue
+    uint32_t id;
+
+    // The ring of records
+    alignas(NanoLogConfig::BYTES_PER_CACHE_LINE)
+    Slot slots[NUM_SLOTS];
+};
+
+}; // namespace Alternatives
+
+#endif // FASTFORWARDQUEUE_H
@@ -0,0 +1,144 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef FREELIST_H
+#define FREELIST_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace Alternatives {
+
+/**
+ * Lock-free LIFO free list (Treiber stack) used to recycle objects that
+ * are expensive to allocate, such as StagingBuffers whose storage has
+ * already been faulted in. Objects are linked through an intrusive
+ * T::nextFree pointer, so pushing and popping never allocates.
+ *
+ * To avoid the ABA problem, the head pointer is tagged with a 16-bit
+ * modification counter in the (unused) upper bits of the x86-64 virtual
+ * address. Objects pushed into the list are owned by it and deleted when
+ * the list is destroyed.
+ */
+template<typename T>
+class FreeList {
+public:
+    FreeList()
+        : head(0)
+        , numPushes(0)
+        , numPops(0)
+    {
+    }
+
+    ~FreeList() {
+        T *obj;
+        while ((obj = pop()) != nullptr)
+            delete obj;
+    }
+
+    /**
+     * Returns an object to the free list. May be invoked concurrently
+     * from any thread.
+     *
+     * \param obj
+     *      Object to place in the free list
+     */
+    void
+    push(T *obj) {
+        uint64_t oldHead = head.load(std::memory_order_relaxed);
+        uint64_t newHead;
+
+        do {
+            obj->nextFree = getPointer(oldHead);
+            newHead = pack(obj, getTag(oldHead) + 1);
+        } while (!head.compare_exchange_weak(oldHead, newHead,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed));
+
+        numPushes.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Removes an object from the free list. May be invoked concurrently
+     * from any thread.
+     *
+     * \return
+     *      An object previously push()-ed or nullptr if the list is empty
+     */
+    T *
+    pop() {
+        uint64_t oldHead = head.load(std::memory_order_acquire);
+        uint64_t newHead;
+        T *obj;
+
+        do {
+            obj = getPointer(oldHead);
+            if (obj == nullptr)
+                return nullptr;
+
+            // obj may be popped and reused by another thread right after
+            // we read its nextFree, but then the tag will have changed and
+            // the CAS below will fail.
+            newHead = pack(obj->nextFree, getTag(oldHead) + 1);
+        } while (!head.compare_exchange_weak(oldHead, newHead,
+                                             std::memory_order_acquire,
+                                             std::memory_order_acquire));
+
+        numPops.fetch_add(1, std::memory_order_relaxed);
+        return obj;
+    }
+
+    // Number of objects currently in the free list
+    uint64_t
+    size() {
+        return numPushes.load() - numPops.load();
+    }
+
+    // Number of objects that have been pop()-ed for reuse
+    uint64_t
+    getNumPops() {
+        return numPops.load();
+    }
+
+private:
+    static const int TAG_SHIFT = 48;
+    static const uint64_t POINTER_MASK = (1UL << TAG_SHIFT) - 1;
+
+    static inline uint64_t
+    pack(T *ptr, uint64_t tag) {
+        return (tag << TAG_SHIFT) | reinterpret_cast<uint64_t>(ptr);
+    }
+
+    static inline T *
+    getPointer(uint64_t packed) {
+        return reinterpret_cast<T*>(packed & POINTER_MASK);
+    }
+
+    static inline uint64_t
+    getTag(uint64_t packed) {
+        return packed >> TAG_SHIFT;
+    }
+
+    // Tagged pointer to the top of the stack
+    std::atomic<uint64_t> head;
+
+    // Statistics on the usage of the free list
+    std::atomic<uint64_t> numPushes;
+    std::atomic<uint64_t> numPops;
+};
+
+}; // namespace Alternatives
+
+#endif // FREELIST_H
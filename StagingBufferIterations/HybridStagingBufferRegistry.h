@@ -0,0 +1,354 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef HYBRIDSTAGINGBUFFERREGISTRY_H
+#define HYBRIDSTAGINGBUFFERREGISTRY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sched.h>
+
+#include "Config.h"
+#include "Fence.h"
+#include "MpscStagingBuffer.h"
+#include "PerfUtils/Cycles.h"
+
+namespace Alternatives {
+
+/**
+ * Variant of the StagingBufferRegistry that caps the number of dedicated
+ * per-thread StagingBuffers. Threads beyond the cap log into one of
+ * HYBRID_SHARED_BUFFERS MpscStagingBuffers instead, so the memory used
+ * stays bounded no matter how many threads log, while the threads that
+ * log the most still get an uncontended buffer of their own.
+ *
+ * Dedicated buffers are handed out in one of two ways (see configure()):
+ *  - First come: the first threads to log take them until the cap is hit.
+ *  - Hottest: every thread starts on a shared buffer and is promoted to a
+ *    dedicated one once it pushes HYBRID_PROMOTE_PUSHES times within
+ *    HYBRID_PROMOTION_WINDOW_US, as long as fewer than the cap are in use.
+ *
+ * A promoted thread's earlier entries may still sit in its shared buffer
+ * when its later ones reach the consumer, so the output must be ordered by
+ * timestamp (as NanoLog's is) rather than by the order entries are drained.
+ *
+ * The registry is configured for the whole process; configure() may only
+ * be invoked while no thread is logging and all the buffers are drained.
+ * Threads that logged before and are still alive move to the new shared
+ * buffers on their next push().
+ */
+template<typename Buffer>
+class HybridStagingBufferRegistry {
+public:
+    /**
+     * Sets how dedicated buffers are handed out and (re)creates the
+     * shared buffers.
+     *
+     * \param maxDedicatedBuffers
+     *      Largest number of dedicated buffers alive at once
+     * \param promoteAfterPushes
+     *      0 hands the dedicated buffers to the first threads to log;
+     *      otherwise the number of pushes within HYBRID_PROMOTION_WINDOW_US
+     *      after which a thread on a shared buffer is promoted
+     */
+    static void
+    configure(size_t maxDedicatedBuffers, uint64_t promoteAfterPushes) {
+        std::lock_guard<std::mutex> _(bufferMutex);
+        assert(dedicatedBuffers.empty());
+
+        maxDedicated = maxDedicatedBuffers;
+        promoteAfter = promoteAfterPushes;
+        windowCycles = PerfUtils::Cycles::fromNanoseconds(
+                        NanoLogConfig::HYBRID_PROMOTION_WINDOW_US*1000UL);
+
+        sharedBuffers.clear();
+        for (uint32_t i = 0; i < NanoLogConfig::HYBRID_SHARED_BUFFERS; ++i)
+            sharedBuffers.emplace_back(new MpscStagingBuffer(i));
+
+        // Invalidates the threads' pointers to the old shared buffers
+        generation.fetch_add(1, std::memory_order_release);
+
+        maxNumDedicated = 0;
+        numPromotions = 0;
+    }
+
+    /**
+     * Copies a log entry into the calling thread's buffer, blocking while
+     * the buffer is full.
+     *
+     * \param data
+     *      Pointer to the data to copy in
+     * \param nbytes
+     *      Number of bytes to copy from *data
+     */
+    static inline void
+    push(const char *data, uint32_t nbytes) {
+        ThreadState &state = threadState;
+        if (state.dedicated != nullptr) {
+            char *pos = state.dedicated->reserveProducerSpace(nbytes);
+            std::memcpy(pos, data, nbytes);
+            state.dedicated->finishReservation(nbytes);
+            return;
+        }
+
+        pushShared(state, data, nbytes);
+    }
+
+    /**
+     * Makes one pass over all the buffers processing the data available in
+     * each, and reclaims the dedicated buffers whose threads have exited
+     * and that have been fully drained. Only one thread may invoke this
+     * function at a time.
+     *
+     * \param process
+     *      Callable invoked as process(char *data, uint64_t bytes). For a
+     *      dedicated buffer it's passed each contiguous region peek()-ed
+     *      and returns the number of bytes it processed, which will be
+     *      consume()-ed; for a shared buffer it's passed one entry at a
+     *      time, which is removed whole.
+     * \return
+     *      Number of bytes consumed
+     */
+    template<typename Fn>
+    static uint64_t
+    drain(Fn &&process) {
+        uint64_t bytesConsumed = 0;
+        std::unique_lock<std::mutex> lock(bufferMutex);
+
+        size_t i = 0;
+        while (i < dedicatedBuffers.size()) {
+            Buffer *sb = dedicatedBuffers[i];
+
+            lock.unlock();
+            uint64_t bytesAvail;
+            char *data = sb->peek(&bytesAvail);
+            if (bytesAvail > 0) {
+                uint64_t processed = process(data, bytesAvail);
+                sb->consume(processed);
+                bytesConsumed += processed;
+            }
+            lock.lock();
+
+            if (sb->shouldDeallocate) {
+                // Ensures we read the producer's final producerPos
+                NanoLogInternal::Fence::lfence();
+
+                if (sb->checkCanDelete()) {
+                    dedicatedBuffers.erase(dedicatedBuffers.begin() + i);
+                    delete sb;
+                    continue;
+                }
+            }
+
+            ++i;
+        }
+        lock.unlock();
+
+        // The shared buffers are only replaced by configure()
+        for (auto &shared : sharedBuffers) {
+            uint32_t nbytes;
+            char *data;
+            while ((data = shared->front(&nbytes)) != nullptr) {
+                process(data, nbytes);
+                shared->pop();
+                bytesConsumed += nbytes;
+            }
+        }
+
+        return bytesConsumed;
+    }
+
+    // Number of dedicated buffers currently alive
+    static size_t
+    getNumDedicated() {
+        std::lock_guard<std::mutex> _(bufferMutex);
+        return dedicatedBuffers.size();
+    }
+
+    // Largest number of dedicated buffers alive at once
+    static size_t
+    getMaxNumDedicated() {
+        std::lock_guard<std::mutex> _(bufferMutex);
+        return maxNumDedicated;
+    }
+
+    // Number of threads moved from a shared buffer to a dedicated one
+    static uint64_t
+    getNumPromotions() {
+        std::lock_guard<std::mutex> _(bufferMutex);
+        return numPromotions;
+    }
+
+    // Largest number of bytes allocated for buffer storage at once
+    static uint64_t
+    getPeakBytesAllocated() {
+        std::lock_guard<std::mutex> _(bufferMutex);
+        return maxNumDedicated*uint64_t(NanoLogConfig::STAGING_BUFFER_SIZE) +
+               sharedBuffers.size()*MpscStagingBuffer::getBytesAllocated();
+    }
+
+private:
+    /**
+     * The calling thread's view of the registry. An instance lives in
+     * thread-local storage so that its destructor marks the thread's
+     * dedicated buffer for deallocation when the thread exits.
+     */
+    struct ThreadState {
+        // Dedicated buffer, or nullptr if the thread logs to a shared one
+        Buffer *dedicated;
+
+        // Shared buffer, or nullptr if not yet assigned
+        MpscStagingBuffer *shared;
+
+        // Registry generation that shared was assigned in
+        uint64_t generation;
+
+        // Pushes into the shared buffer since windowStart
+        uint64_t windowPushes;
+
+        // rdtsc() value at the start of the current promotion window
+        uint64_t windowStart;
+
+        ThreadState()
+            : dedicated(nullptr)
+            , shared(nullptr)
+            , generation(0)
+            , windowPushes(0)
+            , windowStart(0)
+        {
+        }
+
+        ~ThreadState() {
+            if (dedicated != nullptr) {
+                // Make sure the final producerPos is visible first
+                NanoLogInternal::Fence::sfence();
+                dedicated->shouldDeallocate = true;
+                dedicated = nullptr;
+            }
+        }
+    };
+
+    /**
+     * Slow path of push(): places the thread on its buffers on its first
+     * push, pushes into its shared buffer and checks whether the thread has
+     * become hot enough to be promoted.
+     */
+    static void
+    pushShared(ThreadState &state, const char *data, uint32_t nbytes) {
+        if (state.shared == nullptr || state.generation !=
+                                generation.load(std::memory_order_acquire)) {
+            assignBuffers(state);
+            if (state.dedicated != nullptr) {
+                push(data, nbytes);
+                return;
+            }
+        }
+
+        // The consumer can't free space past a record whose producer was
+        // descheduled before committing it, so give up the CPU while full
+        while (!state.shared->push(data, nbytes))
+            sched_yield();
+
+        if (promoteAfter == 0 || ++state.windowPushes < promoteAfter)
+            return;
+
+        uint64_t now = PerfUtils::Cycles::rdtsc();
+        if (now - state.windowStart <= windowCycles)
+            tryAllocateDedicated(state, true);
+
+        state.windowPushes = 0;
+        state.windowStart = now;
+    }
+
+    /**
+     * Picks the shared buffer of a thread logging for the first time since
+     * configure() and, when dedicated buffers go to the first threads, its
+     * dedicated one.
+     */
+    static void
+    assignBuffers(ThreadState &state) {
+        uint32_t thread = nextThread.fetch_add(1, std::memory_order_relaxed);
+        state.generation = generation.load(std::memory_order_acquire);
+        state.shared = sharedBuffers[thread % sharedBuffers.size()].get();
+        state.windowPushes = 0;
+        state.windowStart = PerfUtils::Cycles::rdtsc();
+
+        if (promoteAfter == 0)
+            tryAllocateDedicated(state, false);
+    }
+
+    /**
+     * Gives the calling thread a dedicated buffer unless the cap has been
+     * reached.
+     *
+     * \param promotion
+     *      true if the thread is moving off its shared buffer
+     */
+    static void
+    tryAllocateDedicated(ThreadState &state, bool promotion) {
+        std::lock_guard<std::mutex> _(bufferMutex);
+        if (dedicatedBuffers.size() >= maxDedicated)
+            return;
+
+        state.dedicated = new Buffer(nextBufferId++);
+        dedicatedBuffers.push_back(state.dedicated);
+        maxNumDedicated = std::max(maxNumDedicated, dedicatedBuffers.size());
+
+        if (promotion)
+            ++numPromotions;
+    }
+
+    // Protects dedicatedBuffers, nextBufferId and the statistics
+    static inline std::mutex bufferMutex;
+
+    // Dedicated buffers that haven't been reclaimed yet
+    static inline std::vector<Buffer*> dedicatedBuffers;
+
+    // Buffers shared by the threads without a dedicated buffer
+    static inline std::vector<std::unique_ptr<MpscStagingBuffer>>
+                                                            sharedBuffers;
+
+    // Settings from configure()
+    static inline size_t maxDedicated = 0;
+    static inline uint64_t promoteAfter = 0;
+    static inline uint64_t windowCycles = 0;
+
+    // Identifier to assign to the next dedicated buffer allocated
+    static inline uint32_t nextBufferId = 0;
+
+    // Number of threads that have logged; spreads them over sharedBuffers
+    static inline std::atomic<uint32_t> nextThread{0};
+
+    // Number of times configure() has replaced sharedBuffers
+    static inline std::atomic<uint64_t> generation{0};
+
+    // Statistics for the benchmarks (see getters above)
+    static inline size_t maxNumDedicated = 0;
+    static inline uint64_t numPromotions = 0;
+
+    // The calling thread's buffers
+    static inline thread_local ThreadState threadState;
+};
+
+}; // namespace Alternatives
+
+#endif // HYBRIDSTAGINGBUFFERREGISTRY_H
@@ -0,0 +1,280 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LOCKS_H
+#define LOCKS_H
+
+#include <atomic>
+#include <cstdint>
+
+#include <pthread.h>
+#include <xmmintrin.h>
+
+#include "Config.h"
+
+/**
+ * This file contains spin lock policies for the StagingBuffers that share a
+ * single buffer between all the producers. They all satisfy BasicLockable
+ * (lock()/unlock()), so std::mutex is a policy as well.
+ *
+ * The queue locks (McsLock and ClhLock) keep their per-thread queue node in
+ * thread local storage, so a thread may hold at most one of each at a time.
+ */
+namespace Locks {
+
+// Test-and-set spin lock; the lock BasicSpinLock uses. Waiters race for the
+// lock on every release, so it's unfair under contention.
+class TasLock {
+public:
+    TasLock()
+        : locked(false)
+    {
+    }
+
+    void
+    lock() {
+        while (locked.exchange(true, std::memory_order_acquire))
+            _mm_pause();
+    }
+
+    // true means the lock was acquired
+    bool
+    try_lock() {
+        return !locked.exchange(true, std::memory_order_acquire);
+    }
+
+    void
+    unlock() {
+        locked.store(false, std::memory_order_release);
+    }
+
+    // Hint that the lock is held, read without taking the cache line
+    // exclusively, so callers can test before they test-and-set
+    bool
+    isLocked() {
+        return locked.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<bool> locked;
+};
+
+/**
+ * Ticket lock: waiters take a ticket and are served in ticket order, which
+ * makes the lock FIFO fair. All waiters still spin on the same cache line,
+ * so every release invalidates all of them.
+ */
+class TicketLock {
+public:
+    TicketLock()
+        : nextTicket(0)
+        , nowServing(0)
+    {
+    }
+
+    void
+    lock() {
+        uint32_t ticket = nextTicket.fetch_add(1, std::memory_order_relaxed);
+        while (nowServing.load(std::memory_order_acquire) != ticket)
+            _mm_pause();
+    }
+
+    void
+    unlock() {
+        // Only the holder writes nowServing
+        nowServing.store(nowServing.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_release);
+    }
+
+private:
+    // Ticket handed to the next thread to arrive
+    std::atomic<uint32_t> nextTicket;
+
+    // Ticket of the thread allowed to hold the lock
+    std::atomic<uint32_t> nowServing;
+};
+
+/**
+ * MCS queue lock: waiters form a linked list through their own nodes and
+ * each spins on a flag in its own node, which its predecessor clears when
+ * it releases the lock. Releases are FIFO and touch only the successor's
+ * cache line.
+ */
+class McsLock {
+public:
+    McsLock()
+        : tail(nullptr)
+    {
+    }
+
+    void
+    lock() {
+        Node &node = myNode;
+        node.next.store(nullptr, std::memory_order_relaxed);
+        node.locked.store(true, std::memory_order_relaxed);
+
+        Node *pred = tail.exchange(&node, std::memory_order_acq_rel);
+        if (pred == nullptr)
+            return;
+
+        pred->next.store(&node, std::memory_order_release);
+        while (node.locked.load(std::memory_order_acquire))
+            _mm_pause();
+    }
+
+    void
+    unlock() {
+        Node &node = myNode;
+        Node *succ = node.next.load(std::memory_order_acquire);
+
+        if (succ == nullptr) {
+            Node *expected = &node;
+            if (tail.compare_exchange_strong(expected, nullptr,
+                                             std::memory_order_release,
+                                             std::memory_order_relaxed))
+                return;
+
+            // A successor swapped itself in but has yet to link to us
+            while ((succ = node.next.load(std::memory_order_acquire))
+                                                                == nullptr)
+                _mm_pause();
+        }
+
+        succ->locked.store(false, std::memory_order_release);
+    }
+
+private:
+    struct alignas(NanoLogConfig::BYTES_PER_CACHE_LINE) Node {
+        std::atomic<Node*> next;
+        std::atomic<bool> locked;
+    };
+
+    // Last thread in the queue, or nullptr if the lock is free
+    std::atomic<Node*> tail;
+
+    // Calling thread's queue node
+    static thread_local Node myNode;
+};
+
+inline thread_local McsLock::Node McsLock::myNode;
+
+/**
+ * CLH queue lock: like the MCS lock, but the queue is implicit. A waiter
+ * swaps its node into the tail and spins on its predecessor's node; on
+ * release it marks its own node free and adopts the predecessor's node for
+ * its next acquisition, so the nodes migrate between threads.
+ */
+class ClhLock {
+public:
+    ClhLock()
+        : tail(new Node())
+    {
+    }
+
+    ~ClhLock() {
+        // Whichever node is at the tail is referenced by no thread
+        delete tail.load();
+    }
+
+    ClhLock(const ClhLock&) = delete;
+    ClhLock& operator=(const ClhLock&) = delete;
+
+    void
+    lock() {
+        Node *node = nodes.mine;
+        node->locked.store(true, std::memory_order_relaxed);
+
+        Node *pred = tail.exchange(node, std::memory_order_acq_rel);
+        while (pred->locked.load(std::memory_order_acquire))
+            _mm_pause();
+
+        nodes.pred = pred;
+    }
+
+    void
+    unlock() {
+        Node *node = nodes.mine;
+        nodes.mine = nodes.pred;
+        node->locked.store(false, std::memory_order_release);
+    }
+
+private:
+    struct alignas(NanoLogConfig::BYTES_PER_CACHE_LINE) Node {
+        std::atomic<bool> locked;
+
+        Node()
+            : locked(false)
+        {
+        }
+    };
+
+    // The calling thread's node and, while it holds the lock, its
+    // predecessor's node, which becomes its own once it releases the lock
+    struct ThreadNodes {
+        Node *mine;
+        Node *pred;
+
+        ThreadNodes()
+            : mine(new Node())
+            , pred(nullptr)
+        {
+        }
+
+        ~ThreadNodes() {
+            delete mine;
+        }
+    };
+
+    // Last node in the queue; its owner holds or last held the lock
+    std::atomic<Node*> tail;
+
+    static thread_local ThreadNodes nodes;
+};
+
+inline thread_local ClhLock::ThreadNodes ClhLock::nodes;
+
+// Wrapper around the pthread spin lock
+class PthreadSpinLock {
+public:
+    PthreadSpinLock()
+        : spinlock()
+    {
+        pthread_spin_init(&spinlock, PTHREAD_PROCESS_PRIVATE);
+    }
+
+    ~PthreadSpinLock() {
+        pthread_spin_destroy(&spinlock);
+    }
+
+    PthreadSpinLock(const PthreadSpinLock&) = delete;
+    PthreadSpinLock& operator=(const PthreadSpinLock&) = delete;
+
+    void
+    lock() {
+        pthread_spin_lock(&spinlock);
+    }
+
+    void
+    unlock() {
+        pthread_spin_unlock(&spinlock);
+    }
+
+private:
+    pthread_spinlock_t spinlock;
+};
+
+}; // namespace Locks
+
+#endif // LOCKS_H
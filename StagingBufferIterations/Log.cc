@@ -0,0 +1,276 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <cassert>
+#include <cstring>
+
+#include "Log.h"
+
+namespace Log {
+
+// Maximum number of bytes a 64-bit integer can occupy after pack()
+static const size_t MAX_PACKED_BYTES = 10;
+
+/**
+ * Packs an integer into a variable number of bytes (7 bits per byte with
+ * the high bit indicating that more bytes follow).
+ *
+ * \param[in/out] out
+ *      Buffer to pack the integer into; will be advanced past the bytes
+ *      written
+ * \param val
+ *      Integer to pack
+ */
+static inline void
+pack(char **out, uint64_t val)
+{
+    uint8_t *pos = reinterpret_cast<uint8_t*>(*out);
+    while (val >= 0x80) {
+        *pos++ = static_cast<uint8_t>(val) | 0x80;
+        val >>= 7;
+    }
+
+    *pos++ = static_cast<uint8_t>(val);
+    *out = reinterpret_cast<char*>(pos);
+}
+
+/**
+ * Complement to pack(); reads an integer back out of the buffer.
+ *
+ * \param[in/out] in
+ *      Buffer to unpack from; will be advanced past the bytes read
+ * \param end
+ *      First invalid byte of the buffer
+ * \param[out] val
+ *      Integer unpacked
+ * \return
+ *      true if successful; false if the integer runs off the end
+ */
+static inline bool
+unpack(const char **in, const char *end, uint64_t *val)
+{
+    const uint8_t *pos = reinterpret_cast<const uint8_t*>(*in);
+    const uint8_t *last = reinterpret_cast<const uint8_t*>(end);
+    uint64_t result = 0;
+
+    for (int shift = 0; shift < 64 && pos < last; shift += 7) {
+        uint8_t byte = *pos++;
+        result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+        if ((byte & 0x80) == 0) {
+            *val = result;
+            *in = reinterpret_cast<const char*>(pos);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Encoder constructor. The encoder will output a FileHeader at the
+ * beginning of the buffer, so the buffer passed in here should be the
+ * first one written to a log file.
+ *
+ * \param buffer
+ *      Buffer to encode chunks into
+ * \param bufferSize
+ *      Number of bytes in the buffer
+ * \param cyclesPerSecond
+ *      Rate at which the timestamps in the log messages advance
+ */
+Encoder::Encoder(char *buffer, size_t bufferSize, double cyclesPerSecond)
+    : backing_buffer(buffer)
+    , writePos(buffer)
+    , endOfBuffer(buffer + bufferSize)
+{
+    assert(bufferSize >= sizeof(FileHeader));
+
+    FileHeader *header = reinterpret_cast<FileHeader*>(writePos);
+    header->magic = FILE_MAGIC;
+    header->cyclesPerSecond = cyclesPerSecond;
+    writePos += sizeof(FileHeader);
+}
+
+/**
+ * Compresses as many complete UncompressedEntries from *from as will
+ * fit in the output buffer into a single chunk.
+ *
+ * \param from
+ *      Beginning of the UncompressedEntries to compress
+ * \param nbytes
+ *      Number of bytes available at *from
+ * \param bufferId
+ *      Identifier of the StagingBuffer the entries were peek()-ed from
+ * \param[out] numEventsCompressed
+ *      Number of log messages compressed
+ * \return
+ *      Number of bytes consumed from *from; 0 means the output buffer
+ *      is full and should be swapped out.
+ */
+uint64_t
+Encoder::encodeLogMsgs(const char *from, uint64_t nbytes, uint32_t bufferId,
+                       uint64_t *numEventsCompressed)
+{
+    *numEventsCompressed = 0;
+    if (endOfBuffer - writePos < static_cast<ptrdiff_t>(sizeof(ChunkHeader)))
+        return 0;
+
+    ChunkHeader *chunk = reinterpret_cast<ChunkHeader*>(writePos);
+    char *out = writePos + sizeof(ChunkHeader);
+
+    const char *in = from;
+    const char *end = from + nbytes;
+    uint64_t lastTimestamp = 0;
+    uint32_t numEntries = 0;
+
+    while (end - in >= static_cast<ptrdiff_t>(sizeof(UncompressedEntry))) {
+        const UncompressedEntry *entry =
+                reinterpret_cast<const UncompressedEntry*>(in);
+        assert(entry->entrySize >= sizeof(UncompressedEntry));
+        assert(entry->entrySize <= end - in);
+
+        uint32_t argBytes = entry->entrySize - sizeof(UncompressedEntry);
+        if (static_cast<size_t>(endOfBuffer - out) <
+                                        MAX_PACKED_ENTRY_OVERHEAD + argBytes)
+            break;
+
+        if (numEntries == 0) {
+            chunk->firstTimestamp = entry->timestamp;
+            lastTimestamp = entry->timestamp;
+        }
+
+        out += packEntry(out, entry->timestamp - lastTimestamp,
+                         entry->argData, argBytes);
+
+        lastTimestamp = entry->timestamp;
+        in += entry->entrySize;
+        ++numEntries;
+    }
+
+    if (numEntries == 0)
+        return 0;
+
+    chunk->magic = CHUNK_MAGIC;
+    chunk->bufferId = bufferId;
+    chunk->numEntries = numEntries;
+    chunk->length = static_cast<uint32_t>(out - writePos - sizeof(ChunkHeader));
+    chunk->lastTimestamp = lastTimestamp;
+
+    writePos = out;
+    *numEventsCompressed = numEntries;
+    return in - from;
+}
+
+/**
+ * Returns the number of bytes encoded into the current output buffer
+ */
+size_t
+Encoder::getEncodedBytes()
+{
+    return writePos - backing_buffer;
+}
+
+/**
+ * Replaces the output buffer with a new one after the old one has been
+ * written out. Unlike the constructor, no FileHeader is emitted since the
+ * encoded chunks continue the same log file.
+ *
+ * \param inBuffer
+ *      New buffer to encode chunks into
+ * \param inSize
+ *      Number of bytes in the new buffer
+ */
+void
+Encoder::swapBuffer(char *inBuffer, size_t inSize)
+{
+    backing_buffer = writePos = inBuffer;
+    endOfBuffer = inBuffer + inSize;
+}
+
+/**
+ * Compresses a single log message into the format used within a chunk.
+ * The chunk's ChunkHeader must be filled in separately, with the
+ * firstTimestamp that the first message's timestampDelta is relative to.
+ *
+ * \param out
+ *      Destination with at least argBytes + MAX_PACKED_ENTRY_OVERHEAD
+ *      bytes of space
+ * \param timestampDelta
+ *      Difference between the message's timestamp and the previous one's
+ *      in the chunk
+ * \param argData
+ *      Raw argument bytes of the log message
+ * \param argBytes
+ *      Number of bytes at argData
+ * \return
+ *      Number of bytes written to out
+ */
+size_t
+packEntry(char *out, uint64_t timestampDelta, const char *argData,
+          uint32_t argBytes)
+{
+    static_assert(2*MAX_PACKED_BYTES == MAX_PACKED_ENTRY_OVERHEAD,
+                  "packEntry() writes two packed integers");
+
+    char *pos = out;
+    pack(&pos, timestampDelta);
+    pack(&pos, argBytes);
+    std::memcpy(pos, argData, argBytes);
+    pos += argBytes;
+
+    return pos - out;
+}
+
+/**
+ * Decodes all the log messages within a single chunk. Since each chunk
+ * is self-contained, this can be invoked on different chunks in parallel.
+ *
+ * \param chunk
+ *      Chunk to decode; the compressed log messages must follow it
+ * \param[out] out
+ *      Vector to append the decoded log messages to
+ * \return
+ *      true if the chunk was decoded successfully; false if it's corrupt
+ */
+bool
+decodeChunk(const ChunkHeader *chunk, std::vector<DecodedEntry> &out)
+{
+    if (chunk->magic != CHUNK_MAGIC)
+        return false;
+
+    const char *in = reinterpret_cast<const char*>(chunk + 1);
+    const char *end = in + chunk->length;
+    uint64_t timestamp = chunk->firstTimestamp;
+
+    out.reserve(out.size() + chunk->numEntries);
+    for (uint32_t i = 0; i < chunk->numEntries; ++i) {
+        uint64_t delta, argBytes;
+        if (!unpack(&in, end, &delta) || !unpack(&in, end, &argBytes))
+            return false;
+
+        if (argBytes > static_cast<uint64_t>(end - in))
+            return false;
+
+        timestamp += delta;
+        out.push_back({timestamp, chunk->bufferId,
+                       static_cast<uint32_t>(argBytes), in});
+        in += argBytes;
+    }
+
+    return in == end;
+}
+
+}; // namespace Log
@@ -0,0 +1,203 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <type_traits>
+#include <vector>
+
+/**
+ * This file describes the records that producers place into the
+ * StagingBuffers and the compressed format that the consumer writes to
+ * the log file. It's a stripped down version of the NanoLog log format:
+ * there are no format strings and no dictionary, so the arguments of
+ * each log message are stored as raw bytes.
+ *
+ * The log file consists of a FileHeader followed by a sequence of Chunks.
+ * Each Chunk contains the compressed log messages from a single
+ * StagingBuffer and can be decoded independently of all other Chunks.
+ */
+namespace Log {
+
+    // Magic numbers used to identify the headers within the log file
+    static const uint32_t FILE_MAGIC = 0x474f4c4e;    // "NLOG"
+    static const uint32_t CHUNK_MAGIC = 0x4b4e4843;   // "CHNK"
+
+    // Upper bound on the number of bytes packEntry() adds to the arguments
+    // of a log message
+    static const size_t MAX_PACKED_ENTRY_OVERHEAD = 20;
+
+    /**
+     * Log message as it's stored in the StagingBuffer by the producer
+     */
+    struct UncompressedEntry {
+        // Runtime timestamp of the log invocation (rdtsc)
+        uint64_t timestamp;
+
+        // Number of bytes this entry occupies, including this header
+        uint32_t entrySize;
+
+        // Raw argument bytes of the log message
+        char argData[0];
+    } __attribute__((packed));
+
+    /**
+     * Marks the beginning of a log file and contains the information
+     * needed to translate the runtime timestamps into wall time.
+     */
+    struct FileHeader {
+        // Always FILE_MAGIC
+        uint32_t magic;
+
+        // Rate at which the runtime timestamps advance
+        double cyclesPerSecond;
+    } __attribute__((packed));
+
+    /**
+     * Precedes the compressed log messages from a single StagingBuffer.
+     * The timestamps within a chunk are delta encoded against
+     * firstTimestamp, so a chunk never depends on the chunks before it.
+     */
+    struct ChunkHeader {
+        // Always CHUNK_MAGIC
+        uint32_t magic;
+
+        // Identifier of the StagingBuffer the log messages came from
+        uint32_t bufferId;
+
+        // Number of log messages encoded in this chunk
+        uint32_t numEntries;
+
+        // Number of bytes of compressed log messages following this header
+        uint32_t length;
+
+        // Timestamps of the first and last log messages in the chunk
+        uint64_t firstTimestamp;
+        uint64_t lastTimestamp;
+    } __attribute__((packed));
+
+    /**
+     * Log message after it has been decoded from a chunk. The argData
+     * points directly into the chunk that it was decoded from.
+     */
+    struct DecodedEntry {
+        uint64_t timestamp;
+        uint32_t bufferId;
+        uint32_t argBytes;
+        const char *argData;
+    };
+
+    /**
+     * Compresses the UncompressedEntries in the StagingBuffers into chunks
+     * within a user-provided output buffer.
+     */
+    class Encoder {
+    public:
+        Encoder(char *buffer, size_t bufferSize, double cyclesPerSecond);
+
+        uint64_t encodeLogMsgs(const char *from, uint64_t nbytes,
+                               uint32_t bufferId,
+                               uint64_t *numEventsCompressed);
+        size_t getEncodedBytes();
+        void swapBuffer(char *inBuffer, size_t inSize);
+
+    private:
+        // Start of the buffer that compressed chunks are written to
+        char *backing_buffer;
+
+        // Position within backing_buffer where the next byte is written
+        char *writePos;
+
+        // Points to the first invalid byte of the backing_buffer
+        char *endOfBuffer;
+    };
+
+    size_t packEntry(char *out, uint64_t timestampDelta,
+                     const char *argData, uint32_t argBytes);
+    bool decodeChunk(const ChunkHeader *chunk,
+                     std::vector<DecodedEntry> &out);
+
+    /**
+     * Encodes the UncompressedEntry of a log statement whose argument
+     * types are known at compile time. The record size is a compile-time
+     * constant, so the producer reserves exactly that much space and the
+     * arguments are written with a fixed sequence of stores instead of a
+     * runtime-sized memcpy.
+     *
+     * \tparam Args
+     *      Types of the log statement's arguments, in order. They are
+     *      stored back-to-back (unaligned) in the entry's argData.
+     */
+    template<typename... Args>
+    struct RecordEncoder {
+        static_assert((std::is_trivially_copyable<Args>::value && ...),
+                      "log arguments must be trivially copyable");
+
+        // Number of argument bytes following the UncompressedEntry header
+        static constexpr uint32_t argBytes = (sizeof(Args) + ... + 0);
+
+        // Total number of bytes the encoded entry occupies
+        static constexpr uint32_t recordSize =
+                                    sizeof(UncompressedEntry) + argBytes;
+
+        /**
+         * Writes the entry for one log invocation to out.
+         *
+         * \param out
+         *      Destination with at least recordSize bytes of space
+         * \param timestamp
+         *      Runtime timestamp of the log invocation
+         * \param args
+         *      Arguments of the log invocation
+         */
+        static inline void
+        encode(char *out, uint64_t timestamp, const Args&... args) {
+            auto *entry = reinterpret_cast<UncompressedEntry*>(out);
+            entry->timestamp = timestamp;
+            entry->entrySize = recordSize;
+
+            // Each memcpy has a constant size and lands at a constant
+            // offset, so the fold compiles down to plain stores.
+            char *pos = entry->argData;
+            ((std::memcpy(pos, &args, sizeof(Args)), pos += sizeof(Args)), ...);
+        }
+
+        /**
+         * Reserves exactly recordSize bytes in a StagingBuffer, encodes the
+         * log invocation into it and makes it visible to the consumer.
+         *
+         * \param sb
+         *      StagingBuffer with the two-stage reserve/finish API
+         * \param timestamp
+         *      Runtime timestamp of the log invocation
+         * \param args
+         *      Arguments of the log invocation
+         */
+        template<typename Buffer>
+        static inline void
+        log(Buffer *sb, uint64_t timestamp, const Args&... args) {
+            encode(sb->reserveProducerSpace(recordSize), timestamp, args...);
+            sb->finishReservation(recordSize);
+        }
+    };
+
+}; // namespace Log
+
+#endif // LOG_H
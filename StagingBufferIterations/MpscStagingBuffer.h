@@ -0,0 +1,220 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MPSCSTAGINGBUFFER_H
+#define MPSCSTAGINGBUFFER_H
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include "Config.h"
+#include "Fence.h"
+
+namespace Alternatives {
+
+/**
+ * Lock-free circular byte buffer shared by multiple producers and drained by
+ * a single consumer. Producers claim space by advancing a shared 64-bit head
+ * with a compare-and-swap and then fill in their record concurrently with
+ * one another; a record becomes visible when its header's length is stored,
+ * so the consumer never sees a partially written record and records can be
+ * committed out of order. A record that would straddle the end of the
+ * storage is preceded by a skip record covering the remaining space.
+ *
+ * The consumer zeroes every region it consumes before handing it back, so a
+ * zero length always marks a record that has yet to be committed, wherever
+ * the next lap's record boundaries fall.
+ */
+class MpscStagingBuffer {
+public:
+    explicit MpscStagingBuffer(uint32_t id)
+        : head(0)
+        , tail(0)
+        , readPos(0)
+        , currentLength(0)
+        , id(id)
+        , storage(static_cast<char*>(
+                    aligned_alloc(NanoLogConfig::BYTES_PER_CACHE_LINE, SIZE)))
+    {
+        assert(storage);
+        std::memset(storage, 0, SIZE);
+    }
+
+    ~MpscStagingBuffer() {
+        free(storage);
+    }
+
+    MpscStagingBuffer(const MpscStagingBuffer&) = delete;
+    MpscStagingBuffer& operator=(const MpscStagingBuffer&) = delete;
+
+    /**
+     * Copies a record into the buffer and makes it visible to the consumer.
+     * May be invoked by any number of threads at once.
+     *
+     * \param data
+     *      Pointer to the data to copy in
+     * \param nbytes
+     *      Number of bytes to copy from *data
+     * \return
+     *      true is success; false means insufficient space
+     */
+    bool
+    push(const char *data, uint32_t nbytes) {
+        const uint64_t size = recordSize(nbytes);
+        assert(size <= SIZE/2);
+
+        uint64_t pos = head.load(std::memory_order_relaxed);
+        uint64_t offset, total;
+        do {
+            offset = pos & (SIZE - 1);
+            total = (offset + size > SIZE) ? (SIZE - offset) + size : size;
+
+            if (pos + total - tail > SIZE)
+                return false;
+        } while (!head.compare_exchange_weak(pos, pos + total,
+                                             std::memory_order_acq_rel,
+                                             std::memory_order_relaxed));
+
+        RecordHeader *header = reinterpret_cast<RecordHeader*>(
+                                                        storage + offset);
+        if (total != size) {
+            header->payloadBytes = SKIP;
+            header->length.store(static_cast<uint32_t>(SIZE - offset),
+                                 std::memory_order_release);
+            header = reinterpret_cast<RecordHeader*>(storage);
+        }
+
+        header->payloadBytes = nbytes;
+        std::memcpy(reinterpret_cast<char*>(header + 1), data, nbytes);
+        header->length.store(static_cast<uint32_t>(size),
+                             std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Returns the next committed record without removing it. Records are
+     * returned in the order their space was claimed, so a record that's
+     * still being filled in holds back the ones claimed after it.
+     *
+     * \param[out] nbytes
+     *      Number of bytes in the record
+     * \return
+     *      Pointer to the record, or nullptr if the next one isn't committed
+     */
+    char *
+    front(uint32_t *nbytes) {
+        while (true) {
+            RecordHeader *header = reinterpret_cast<RecordHeader*>(
+                                        storage + (readPos & (SIZE - 1)));
+            uint32_t length = header->length.load(std::memory_order_acquire);
+            if (length == 0)
+                return nullptr;
+
+            if (header->payloadBytes == SKIP) {
+                release(length);
+                continue;
+            }
+
+            currentLength = length;
+            *nbytes = header->payloadBytes;
+            return reinterpret_cast<char*>(header + 1);
+        }
+    }
+
+    /**
+     * Releases the record returned by front() back to the producers.
+     */
+    void
+    pop() {
+        assert(currentLength > 0);
+        release(currentLength);
+        currentLength = 0;
+    }
+
+    uint32_t getId() {
+        return id;
+    }
+
+    // Number of bytes of memory the buffer occupies
+    static constexpr uint64_t
+    getBytesAllocated() {
+        return SIZE;
+    }
+
+private:
+    // Precedes every record in storage; records are 8-byte aligned
+    struct RecordHeader {
+        // Number of bytes the record occupies including this header and
+        // padding; 0 until the producer commits the record
+        std::atomic<uint32_t> length;
+
+        // Number of bytes of data, or SKIP for a skip record
+        uint32_t payloadBytes;
+    };
+
+    static_assert(sizeof(RecordHeader) == 8, "RecordHeader must be 8 bytes");
+
+    // payloadBytes of a record that only pads out the end of storage
+    static const uint32_t SKIP = 0xFFFFFFFF;
+
+    // Bytes of storage; a power of 2
+    static const uint64_t SIZE = NanoLogConfig::STAGING_BUFFER_SIZE;
+    static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+
+    static uint64_t
+    recordSize(uint32_t nbytes) {
+        return (sizeof(RecordHeader) + nbytes + 7) & ~uint64_t(7);
+    }
+
+    /**
+     * Zeroes the next length bytes of storage and hands them back to the
+     * producers.
+     */
+    void
+    release(uint32_t length) {
+        std::memset(storage + (readPos & (SIZE - 1)), 0, length);
+        readPos += length;
+
+        // The zeroes must be visible before producers may claim the space
+        NanoLogInternal::Fence::sfence();
+        tail = readPos;
+    }
+
+    // Position of the next byte to be claimed by a producer. Positions
+    // count bytes from the buffer's creation and never wrap.
+    alignas(NanoLogConfig::BYTES_PER_CACHE_LINE)
+    std::atomic<uint64_t> head;
+
+    // Position up to which the consumer has released space
+    alignas(NanoLogConfig::BYTES_PER_CACHE_LINE)
+    volatile uint64_t tail;
+
+    // Consumer's position and the length of the record front() returned
+    uint64_t readPos;
+    uint32_t currentLength;
+
+    // User-assigned identifier for this buffer
+    uint32_t id;
+
+    // Backing store used to implement the circular queue
+    char *storage;
+};
+
+}; // namespace Alternatives
+
+#endif // MPSCSTAGINGBUFFER_H
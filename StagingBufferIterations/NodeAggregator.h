@@ -0,0 +1,203 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef NODEAGGREGATOR_H
+#define NODEAGGREGATOR_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "Config.h"
+#include "Log.h"
+
+namespace Alternatives {
+
+/**
+ * Returns the CPUs of every NUMA node as listed in sysfs. If the kernel
+ * doesn't expose the NUMA topology, all the CPUs are reported as one node.
+ */
+static inline std::vector<std::vector<int>>
+getCpusPerNumaNode()
+{
+    std::vector<std::vector<int>> nodes;
+
+    for (int node = 0; ; ++node) {
+        std::string path = "/sys/devices/system/node/node" +
+                           std::to_string(node) + "/cpulist";
+        FILE *file = fopen(path.c_str(), "r");
+        if (file == nullptr)
+            break;
+
+        // The list looks like "0-3,8-11"
+        std::vector<int> cpus;
+        int first, last;
+        while (fscanf(file, "%d", &first) == 1) {
+            last = first;
+            int separator = fgetc(file);
+            if (separator == '-') {
+                if (fscanf(file, "%d", &last) != 1)
+                    break;
+                separator = fgetc(file);
+            }
+
+            for (int cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+
+            if (separator != ',')
+                break;
+        }
+        fclose(file);
+
+        // Memory-only nodes have no CPUs to run threads on
+        if (!cpus.empty())
+            nodes.push_back(cpus);
+    }
+
+    if (nodes.empty()) {
+        nodes.emplace_back();
+        for (long cpu = 0; cpu < sysconf(_SC_NPROCESSORS_CONF); ++cpu)
+            nodes.back().push_back(static_cast<int>(cpu));
+    }
+
+    return nodes;
+}
+
+/**
+ * Second level of a hierarchy of StagingBuffers. An aggregator thread runs
+ * on every NUMA node and moves the log entries from the per-thread
+ * StagingBuffers of the producers on its node into a single node-local
+ * ring, in large batches. The global consumer then reads only the
+ * aggregated rings, so it polls one buffer per node instead of one per
+ * producer, and the bytes it pulls from remote nodes arrive in long
+ * contiguous runs rather than in small per-producer pieces.
+ *
+ * Entries are moved whole, so every ring holds a stream of complete
+ * Log::UncompressedEntry records.
+ *
+ * \tparam Buffer
+ *      Type of the per-thread StagingBuffers
+ * \tparam Ring
+ *      Type of the aggregated ring; it should be larger than a Buffer
+ *      since it holds the entries of every producer on the node
+ */
+template<typename Buffer, typename Ring>
+class NodeAggregator {
+public:
+    /**
+     * Constructs an aggregator for a node. It should be constructed by the
+     * thread that will run it, on the node, so that the kernel places the
+     * ring's memory there when the aggregator first writes it.
+     *
+     * \param id
+     *      Identifier of the aggregated ring
+     */
+    explicit NodeAggregator(uint32_t id)
+        : ring(id)
+        , sources()
+        , bytesMoved(0)
+        , numBatches(0)
+    {
+    }
+
+    // Adds a producer's StagingBuffer to the ones drained by drainOnce()
+    void
+    addSource(Buffer *sb) {
+        sources.push_back(sb);
+    }
+
+    /**
+     * Moves the entries available in every source into the aggregated
+     * ring, at most AGGREGATION_BATCH_BYTES at a time from each, blocking
+     * while the ring is full.
+     *
+     * \return
+     *      Number of entries moved
+     */
+    uint64_t
+    drainOnce() {
+        uint64_t entriesMoved = 0;
+
+        for (Buffer *sb : sources) {
+            uint64_t bytesAvailable;
+            const char *peekPos = sb->peek(&bytesAvailable);
+
+            // Only move whole entries
+            uint64_t batchBytes = 0;
+            uint64_t batchEntries = 0;
+            while (bytesAvailable - batchBytes >=
+                                        sizeof(Log::UncompressedEntry)) {
+                auto *entry = reinterpret_cast<const Log::UncompressedEntry*>(
+                                                        peekPos + batchBytes);
+                if (batchBytes + entry->entrySize >
+                                NanoLogConfig::AGGREGATION_BATCH_BYTES)
+                    break;
+
+                batchBytes += entry->entrySize;
+                ++batchEntries;
+            }
+
+            if (batchBytes == 0)
+                continue;
+
+            char *dst = ring.reserveProducerSpace(batchBytes);
+            std::memcpy(dst, peekPos, batchBytes);
+            ring.finishReservation(batchBytes);
+            sb->consume(batchBytes);
+
+            bytesMoved += batchBytes;
+            entriesMoved += batchEntries;
+            ++numBatches;
+        }
+
+        return entriesMoved;
+    }
+
+    // Node-local ring that the global consumer reads from
+    Ring *
+    getRing() {
+        return &ring;
+    }
+
+    uint64_t
+    getBytesMoved() {
+        return bytesMoved;
+    }
+
+    uint64_t
+    getNumBatches() {
+        return numBatches;
+    }
+
+private:
+    // Aggregated ring of the node's entries
+    Ring ring;
+
+    // StagingBuffers of the producers on the node
+    std::vector<Buffer*> sources;
+
+    // Metrics: Number of bytes moved into the ring and the number of
+    // copies they took
+    uint64_t bytesMoved;
+    uint64_t numBatches;
+};
+
+}; // namespace Alternatives
+
+#endif // NODEAGGREGATOR_H
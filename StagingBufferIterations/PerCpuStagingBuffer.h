@@ -0,0 +1,401 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PERCPUSTAGINGBUFFER_H
+#define PERCPUSTAGINGBUFFER_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <sched.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#if __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define HAVE_RSEQ 1
+#else
+#define HAVE_RSEQ 0
+#endif
+
+#include "Config.h"
+#include "Fence.h"
+
+namespace Alternatives {
+
+/**
+ * StagingBuffer that's shared by all the threads running on a CPU rather
+ * than owned by a single thread, so the memory used scales with the number
+ * of cores instead of the number of threads.
+ *
+ * Producers on the same CPU are serialized with Linux restartable
+ * sequences (rseq) rather than atomics or locks: the reservation, copy and
+ * commit of a record execute as an rseq critical section that the kernel
+ * aborts (and we retry) if the thread is preempted, migrated or signaled
+ * before the final store that publishes the record. This relies on glibc
+ * (2.35+) having registered rseq for every thread.
+ *
+ * Since records from different threads share a buffer, each record is
+ * framed with a RecordHeader and padded to 8 bytes. When a record doesn't
+ * fit before the end of the buffer, a padding record fills the gap and the
+ * record is placed at the beginning of the buffer.
+ */
+class PerCpuStagingBuffer {
+public:
+    /**
+     * Precedes every record in a per-CPU buffer
+     */
+    struct RecordHeader {
+        // Number of bytes of data following the header
+        uint32_t length;
+
+        // Non-zero if the record only fills space before a roll over
+        uint32_t isPadding;
+    };
+
+    PerCpuStagingBuffer()
+        : numCpus(sysconf(_SC_NPROCESSORS_CONF))
+        , cpuBuffers(nullptr)
+    {
+        cpuBuffers = new CpuBuffer[numCpus];
+    }
+
+    ~PerCpuStagingBuffer() {
+        delete[] cpuBuffers;
+    }
+
+    /**
+     * Returns true if rseq is registered for the calling thread; push()
+     * cannot be used otherwise.
+     */
+    static bool
+    isSupported() {
+#if HAVE_RSEQ
+        return __rseq_size > 0 &&
+                static_cast<int32_t>(getRseq()->cpu_id) >= 0;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * Copies nbytes of data into the buffer of the CPU the calling thread
+     * is running on, blocking if there's not enough space.
+     *
+     * \param data
+     *      Pointer to the data to copy in
+     * \param nbytes
+     *      Number of bytes to copy from *data
+     */
+    void
+    push(const char *data, uint32_t nbytes) {
+        const uint64_t recordBytes = alignRecord(sizeof(RecordHeader) + nbytes);
+        assert(recordBytes <= NanoLogConfig::PER_CPU_BUFFER_SIZE);
+
+        while (true) {
+            uint32_t cpu = getRseq()->cpu_id_start;
+            CpuBuffer &cb = cpuBuffers[cpu];
+
+            uint64_t head = cb.head;
+            uint64_t offset = head & BUFFER_MASK;
+            uint64_t padding = 0;
+            if (NanoLogConfig::PER_CPU_BUFFER_SIZE - offset < recordBytes)
+                padding = NanoLogConfig::PER_CPU_BUFFER_SIZE - offset;
+
+            // Space checks use a cached copy of the consumer's tail to avoid
+            // touching its cache line on every push. A stale (lower) value
+            // written by a preempted thread is harmless since it's only
+            // ever a conservative bound.
+            if (head + padding + recordBytes - cb.cachedTail >
+                                        NanoLogConfig::PER_CPU_BUFFER_SIZE) {
+                cb.cachedTail = cb.tail;
+                if (head + padding + recordBytes - cb.cachedTail >
+                                        NanoLogConfig::PER_CPU_BUFFER_SIZE) {
+                    // There are typically more threads than cores here, so
+                    // give up the CPU rather than spinning and starving
+                    // the consumer.
+                    cb.numTimesProducerBlocked.fetch_add(1,
+                                                std::memory_order_relaxed);
+                    sched_yield();
+                }
+                continue;
+            }
+
+            RecordHeader header;
+            int ret;
+            if (padding > 0) {
+                header = {static_cast<uint32_t>(padding -
+                                                sizeof(RecordHeader)), 1};
+                ret = tryCommit(cpu, &cb.head, head,
+                                cb.storage + offset, header,
+                                nullptr, 0, head + padding);
+            } else {
+                header = {nbytes, 0};
+                ret = tryCommit(cpu, &cb.head, head,
+                                cb.storage + offset, header,
+                                data, nbytes, head + recordBytes);
+            }
+
+            if (ret == 0 && padding == 0)
+                return;
+
+            if (ret != 0)
+                cb.numRestarts.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Consumes all the records currently available in a CPU's buffer.
+     * Only a single consumer may invoke this at a time.
+     *
+     * \param cpu
+     *      CPU whose buffer should be drained
+     * \param process
+     *      Callable invoked as process(const char *data, uint32_t bytes)
+     *      on each record
+     * \return
+     *      Number of records consumed
+     */
+    template<typename Fn>
+    uint64_t
+    drain(int cpu, Fn &&process) {
+        CpuBuffer &cb = cpuBuffers[cpu];
+        uint64_t head = cb.head;
+        uint64_t tail = cb.tail;
+        uint64_t numRecords = 0;
+
+        // Make sure the record reads happen after reading head
+        NanoLogInternal::Fence::lfence();
+
+        while (tail < head) {
+            auto header = reinterpret_cast<RecordHeader*>(
+                                        cb.storage + (tail & BUFFER_MASK));
+            if (!header->isPadding) {
+                process(reinterpret_cast<char*>(header + 1), header->length);
+                ++numRecords;
+            }
+
+            tail += alignRecord(sizeof(RecordHeader) + header->length);
+        }
+
+        // Make sure consumer reads finish before bump
+        NanoLogInternal::Fence::lfence();
+        cb.tail = tail;
+        return numRecords;
+    }
+
+    // Number of per-CPU buffers
+    int
+    getNumCpus() {
+        return numCpus;
+    }
+
+    // Number of bytes allocated for the per-CPU buffers
+    uint64_t
+    getBytesAllocated() {
+        return uint64_t(numCpus)*NanoLogConfig::PER_CPU_BUFFER_SIZE;
+    }
+
+    // Number of times a push() was restarted by the kernel or a racing
+    // producer on the same CPU
+    uint64_t
+    getNumRestarts() {
+        uint64_t restarts = 0;
+        for (int i = 0; i < numCpus; ++i)
+            restarts += cpuBuffers[i].numRestarts.load(
+                                                std::memory_order_relaxed);
+
+        return restarts;
+    }
+
+private:
+    static_assert((NanoLogConfig::PER_CPU_BUFFER_SIZE &
+                    (NanoLogConfig::PER_CPU_BUFFER_SIZE - 1)) == 0,
+                  "PER_CPU_BUFFER_SIZE must be a power of 2");
+
+    static const uint64_t BUFFER_MASK = NanoLogConfig::PER_CPU_BUFFER_SIZE - 1;
+
+    /**
+     * Buffer for a single CPU. Positions are free-running byte counts that
+     * are masked to index into storage[].
+     */
+    struct CpuBuffer {
+        // Total bytes committed by producers; only updated by the commit
+        // instruction of an rseq critical section.
+        alignas(NanoLogConfig::BYTES_PER_CACHE_LINE)
+        volatile uint64_t head;
+
+        // Producers' copy of tail (see push())
+        uint64_t cachedTail;
+
+        // Statistics updated by the producers on this CPU. They're bumped
+        // outside the rseq critical section, where a preempted producer
+        // could race with another on the same CPU, so they're atomic; and
+        // kept apart from head so the bumps don't invalidate it.
+        alignas(NanoLogConfig::BYTES_PER_CACHE_LINE)
+        std::atomic<uint64_t> numTimesProducerBlocked;
+        std::atomic<uint64_t> numRestarts;
+
+        // Total bytes consumed; only updated by the consumer
+        alignas(NanoLogConfig::BYTES_PER_CACHE_LINE)
+        volatile uint64_t tail;
+
+        // Backing store for the records
+        char *storage;
+
+        CpuBuffer()
+            : head(0)
+            , cachedTail(0)
+            , numTimesProducerBlocked(0)
+            , numRestarts(0)
+            , tail(0)
+            , storage(static_cast<char*>(
+                        aligned_alloc(NanoLogConfig::BYTES_PER_CACHE_LINE,
+                                      NanoLogConfig::PER_CPU_BUFFER_SIZE)))
+        {
+            assert(storage);
+        }
+
+        ~CpuBuffer() {
+            free(storage);
+        }
+    };
+
+    // Rounds a record size up so that every header stays 8-byte aligned
+    static inline uint64_t
+    alignRecord(uint64_t nbytes) {
+        return (nbytes + 7) & ~7UL;
+    }
+
+#if HAVE_RSEQ
+    // Returns the calling thread's rseq area registered by glibc
+    static inline struct rseq *
+    getRseq() {
+        return reinterpret_cast<struct rseq*>(
+                static_cast<char*>(__builtin_thread_pointer()) + __rseq_offset);
+    }
+
+    /**
+     * rseq critical section that writes a record and publishes it by
+     * storing newHead into *head, provided the thread is still on cpu and
+     * no other producer on the CPU has committed since *head was read.
+     *
+     * \return
+     *      0 on success, -1 if the kernel aborted the critical section and
+     *      1 if *head no longer matched expectedHead.
+     */
+    static inline int
+    tryCommit(uint32_t cpu, volatile uint64_t *head, uint64_t expectedHead,
+              char *dst, RecordHeader header, const char *src, uint64_t len,
+              uint64_t newHead)
+    {
+        struct rseq *rs = getRseq();
+        uint64_t *rseqCs = reinterpret_cast<uint64_t*>(
+                reinterpret_cast<char*>(rs) + offsetof(struct rseq, rseq_cs));
+        uint64_t packedHeader;
+        std::memcpy(&packedHeader, &header, sizeof(packedHeader));
+
+        __asm__ __volatile__ goto (
+            // Critical section descriptor (struct rseq_cs)
+            ".pushsection __rseq_cs, \"aw\"\n\t"
+            ".balign 32\n\t"
+            "3:\n\t"
+            ".long 0x0, 0x0\n\t"
+            ".quad 1f, (2f - 1f), 4f\n\t"
+            ".popsection\n\t"
+            ".pushsection __rseq_cs_ptr_array, \"aw\"\n\t"
+            ".quad 3b\n\t"
+            ".popsection\n\t"
+
+            // Enter the critical section
+            "leaq 3b(%%rip), %%rax\n\t"
+            "movq %%rax, %[rseqCs]\n\t"
+            "1:\n\t"
+            "cmpl %[cpu], %[cpuId]\n\t"
+            "jnz %l[aborted]\n\t"
+            "cmpq %[expectedHead], %[head]\n\t"
+            "jnz %l[raced]\n\t"
+
+            // Write the record
+            "movq %[header], (%[dst])\n\t"
+            "leaq 8(%[dst]), %%rdi\n\t"
+            "movq %[src], %%rsi\n\t"
+            "movq %[len], %%rcx\n\t"
+            "rep movsb\n\t"
+            "sfence\n\t"
+
+            // Commit
+            "movq %[newHead], %[head]\n\t"
+            "2:\n\t"
+
+            // Abort handler; must be preceded by the rseq signature
+            ".pushsection __rseq_failure, \"ax\"\n\t"
+            ".byte 0x0f, 0xb9, 0x3d\n\t"
+            ".long 0x53053053\n\t"
+            "4:\n\t"
+            "jmp %l[aborted]\n\t"
+            ".popsection\n\t"
+            :
+            : [rseqCs] "m" (*rseqCs),
+              [cpuId] "m" (rs->cpu_id),
+              [cpu] "r" (cpu),
+              [head] "m" (*head),
+              [expectedHead] "r" (expectedHead),
+              [newHead] "r" (newHead),
+              [header] "r" (packedHeader),
+              [dst] "r" (dst),
+              [src] "rm" (src),
+              [len] "rm" (len)
+            : "memory", "cc", "rax", "rcx", "rsi", "rdi"
+            : aborted, raced);
+
+        return 0;
+    aborted:
+        return -1;
+    raced:
+        return 1;
+    }
+#else
+    // Stand-in for struct rseq so that push() compiles without rseq
+    struct RseqUnavailable {
+        uint32_t cpu_id_start;
+    };
+
+    static inline RseqUnavailable *
+    getRseq() {
+        static RseqUnavailable rs = {0};
+        return &rs;
+    }
+
+    static inline int
+    tryCommit(uint32_t, volatile uint64_t *, uint64_t, char *, RecordHeader,
+              const char *, uint64_t, uint64_t) {
+        abort();
+    }
+#endif
+
+    // Number of per-CPU buffers in cpuBuffers[]
+    const int numCpus;
+
+    // One buffer per configured CPU, indexed by CPU number
+    CpuBuffer *cpuBuffers;
+};
+
+}; // namespace Alternatives
+
+#endif // PERCPUSTAGINGBUFFER_H
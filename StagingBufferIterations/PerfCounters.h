@@ -0,0 +1,140 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <cstdint>
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Thin wrapper around a Linux perf_event_open() hardware counter that
+ * counts events for the calling thread only. Counters are commonly
+ * unavailable (e.g. in containers or with a restrictive
+ * perf_event_paranoid), so the benchmarks check isValid() and report the
+ * counts as missing rather than failing.
+ */
+class PerfCounter {
+public:
+    /**
+     * Opens a disabled counter for the calling thread.
+     *
+     * \param type
+     *      perf_event_attr::type, e.g. PERF_TYPE_HARDWARE
+     * \param config
+     *      perf_event_attr::config, e.g. PERF_COUNT_HW_CACHE_MISSES
+     */
+    PerfCounter(uint32_t type, uint64_t config)
+        : fd(-1)
+    {
+        struct perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1,
+                                      -1, 0));
+    }
+
+    ~PerfCounter() {
+        if (fd >= 0)
+            close(fd);
+    }
+
+    PerfCounter(const PerfCounter&) = delete;
+    PerfCounter& operator=(const PerfCounter&) = delete;
+
+    /**
+     * Counter for L1 data cache read misses of the calling thread
+     */
+    static PerfCounter
+    l1dReadMisses() {
+        return {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+    }
+
+    /**
+     * Counter for reads of the calling thread that miss in the local NUMA
+     * node's memory, i.e. that are served by a remote node
+     */
+    static PerfCounter
+    nodeReadMisses() {
+        return {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_NODE |
+                    (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)};
+    }
+
+    /**
+     * Counter for last level cache misses of the calling thread
+     */
+    static PerfCounter
+    llcMisses() {
+        return {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES};
+    }
+
+    /**
+     * Counter for instructions retired by the calling thread
+     */
+    static PerfCounter
+    instructions() {
+        return {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS};
+    }
+
+    // true if the counter could be opened
+    bool
+    isValid() {
+        return fd >= 0;
+    }
+
+    // Resets the count to zero and starts counting
+    void
+    start() {
+        if (fd < 0)
+            return;
+
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    // Stops counting and returns the count, or 0 if the counter is invalid
+    uint64_t
+    stop() {
+        uint64_t count = 0;
+        if (fd < 0)
+            return count;
+
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count))
+            count = 0;
+
+        return count;
+    }
+
+private:
+    // File descriptor returned by perf_event_open(), or -1 on failure
+    int fd;
+};
+
+#endif // PERFCOUNTERS_H
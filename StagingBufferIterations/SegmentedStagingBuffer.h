@@ -0,0 +1,332 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SEGMENTEDSTAGINGBUFFER_H
+#define SEGMENTEDSTAGINGBUFFER_H
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+
+#include "Config.h"
+#include "Fence.h"
+#include "FreeList.h"
+#include "PerfUtils/Cycles.h"
+
+namespace Alternatives {
+
+/**
+ * Fixed-size piece of a SegmentedStagingBuffer. The producer fills a
+ * segment front to back and links in the next one once it runs out of
+ * space; the consumer follows the links and returns drained segments to
+ * the SegmentPool.
+ */
+struct Segment {
+    // Number of bytes at the beginning of data[] that the producer has
+    // made visible to the consumer.
+    volatile uint32_t bytesCommitted;
+
+    // Next segment in the chain. It's set by the producer only after the
+    // final update to bytesCommitted, so once the consumer sees it non-null
+    // it knows bytesCommitted will not change again.
+    Segment *volatile next;
+
+    // Links the segment into the SegmentPool's FreeList
+    Segment *nextFree;
+
+    // Space for the log data
+    alignas(NanoLogConfig::BYTES_PER_CACHE_LINE)
+    char data[NanoLogConfig::SEGMENT_SIZE];
+
+    Segment()
+        : bytesCommitted(0)
+        , next(nullptr)
+        , nextFree(nullptr)
+    {
+    }
+};
+
+/**
+ * Pool of Segments shared by all the SegmentedStagingBuffers. Segments
+ * are allocated on demand (up to a limit) and recycled through a lock-free
+ * FreeList, so the memory used grows with the amount of data buffered
+ * rather than with the number of threads.
+ */
+class SegmentPool {
+public:
+    /**
+     * SegmentPool constructor
+     *
+     * \param maxBytes
+     *      Upper bound on the memory the pool may allocate for Segments.
+     *      Producers block when the limit is reached and there are no free
+     *      Segments.
+     */
+    explicit SegmentPool(uint64_t maxBytes =
+                                NanoLogConfig::SEGMENT_POOL_MAX_BYTES)
+        : freeSegments()
+        , numAllocated(0)
+        , maxSegments(maxBytes/NanoLogConfig::SEGMENT_SIZE)
+    {
+    }
+
+    /**
+     * Returns an empty Segment or nullptr if the pool is exhausted.
+     * May be invoked concurrently from any thread.
+     */
+    Segment *
+    allocate() {
+        Segment *segment = freeSegments.pop();
+
+        if (segment == nullptr) {
+            if (numAllocated.fetch_add(1) >= maxSegments) {
+                numAllocated.fetch_sub(1);
+                return nullptr;
+            }
+
+            return new Segment();
+        }
+
+        segment->bytesCommitted = 0;
+        segment->next = nullptr;
+        return segment;
+    }
+
+    /**
+     * Returns a Segment that's no longer in use to the pool. May be invoked
+     * concurrently from any thread.
+     */
+    void
+    release(Segment *segment) {
+        freeSegments.push(segment);
+    }
+
+    // Number of bytes allocated for Segments (in use or free)
+    uint64_t
+    getBytesAllocated() {
+        return numAllocated.load()*NanoLogConfig::SEGMENT_SIZE;
+    }
+
+    // Pool shared by SegmentedStagingBuffers that aren't given one
+    static SegmentPool &
+    getShared() {
+        static SegmentPool sharedPool;
+        return sharedPool;
+    }
+
+private:
+    // Segments waiting to be reused
+    FreeList<Segment> freeSegments;
+
+    // Number of Segments allocated with new
+    std::atomic<uint64_t> numAllocated;
+
+    // Maximum number of Segments that may be allocated
+    const uint64_t maxSegments;
+};
+
+/**
+ * Single-producer/single-consumer StagingBuffer built from a chain of
+ * Segments drawn from a shared SegmentPool. Instead of blocking when its
+ * current Segment fills up, the producer links in a fresh one, so a
+ * bursty thread can buffer more than a fixed ring allows while an idle
+ * thread holds on to just one Segment.
+ *
+ * The API mirrors StagingBuffer so the two can be benchmarked with the
+ * same producer and consumer functions.
+ */
+class SegmentedStagingBuffer {
+public:
+    /**
+     * SegmentedStagingBuffer constructor
+     *
+     * \param bufferId
+     *      Identifier for the buffer
+     * \param pool
+     *      Pool to draw Segments from
+     */
+    explicit SegmentedStagingBuffer(uint32_t bufferId,
+                                    SegmentPool *pool = &SegmentPool::getShared())
+        : producerSegment(nullptr)
+        , producerOffset(0)
+        , cyclesProducerBlocked(0)
+        , numSegmentsAllocated(0)
+        , pool(pool)
+        , cacheLineSpacer()
+        , consumerSegment(nullptr)
+        , consumerOffset(0)
+        , id(bufferId)
+    {
+        while ((producerSegment = pool->allocate()) == nullptr);
+        consumerSegment = producerSegment;
+    }
+
+    ~SegmentedStagingBuffer() {
+        while (consumerSegment != nullptr) {
+            Segment *next = consumerSegment->next;
+            pool->release(consumerSegment);
+            consumerSegment = next;
+        }
+    }
+
+    /**
+     * Reserves contiguous space for the producer without making it visible
+     * to the consumer; finishReservation() must be invoked before the next
+     * reservation. Moves to a new Segment if the current one is full, and
+     * only blocks when the pool itself is exhausted.
+     *
+     * \param nbytes
+     *      Number of bytes to allocate; must not exceed SEGMENT_SIZE
+     *
+     * \return
+     *      Pointer to at least nbytes of contiguous space
+     */
+    inline char *
+    reserveProducerSpace(size_t nbytes) {
+        assert(nbytes <= NanoLogConfig::SEGMENT_SIZE);
+
+        if (nbytes <= NanoLogConfig::SEGMENT_SIZE - producerOffset)
+            return producerSegment->data + producerOffset;
+
+        return reserveSpaceInternal();
+    }
+
+    /**
+     * Complement to reserveProducerSpace that makes nbytes starting from
+     * the return of reserveProducerSpace visible to the consumer.
+     *
+     * \param nbytes
+     *      Number of bytes to expose to the consumer
+     */
+    inline void
+    finishReservation(size_t nbytes) {
+        assert(producerOffset + nbytes <= NanoLogConfig::SEGMENT_SIZE);
+
+        // Ensures producer finishes writes before bump
+        NanoLogInternal::Fence::sfence();
+        producerOffset += nbytes;
+        producerSegment->bytesCommitted = producerOffset;
+    }
+
+    /**
+     * Peek at the data available for consumption. The contiguous region
+     * returned never spans more than one Segment.
+     *
+     * \param[out] bytesAvailable
+     *      Number of bytes consumable
+     * \return
+     *      Pointer to the consumable space
+     */
+    char *
+    peek(uint64_t *bytesAvailable) {
+        while (true) {
+            uint32_t committed = consumerSegment->bytesCommitted;
+            if (committed > consumerOffset) {
+                *bytesAvailable = committed - consumerOffset;
+                return consumerSegment->data + consumerOffset;
+            }
+
+            Segment *next = consumerSegment->next;
+            if (next == nullptr)
+                break;
+
+            // The producer has moved on; make sure we didn't miss its
+            // final commit to this segment before releasing it.
+            NanoLogInternal::Fence::lfence();
+            if (consumerSegment->bytesCommitted > consumerOffset)
+                continue;
+
+            pool->release(consumerSegment);
+            consumerSegment = next;
+            consumerOffset = 0;
+        }
+
+        *bytesAvailable = 0;
+        return consumerSegment->data + consumerOffset;
+    }
+
+    /**
+     * Consumes the next nbytes and frees them back for reuse. nbytes must
+     * be less than what is returned by peek().
+     *
+     * \param nbytes
+     *      Number of bytes to release
+     */
+    inline void
+    consume(uint64_t nbytes) {
+        // Make sure consumer reads finish before bump
+        NanoLogInternal::Fence::lfence();
+        consumerOffset += nbytes;
+    }
+
+    uint32_t getId() {
+        return id;
+    }
+
+private:
+    /**
+     * Slow path of reserveProducerSpace() that links a new Segment into
+     * the chain, blocking only if the pool is exhausted.
+     */
+    char *
+    reserveSpaceInternal() {
+        Segment *next = pool->allocate();
+
+        if (next == nullptr) {
+            uint64_t start = PerfUtils::Cycles::rdtsc();
+            while ((next = pool->allocate()) == nullptr);
+            cyclesProducerBlocked += PerfUtils::Cycles::rdtsc() - start;
+        }
+
+        // bytesCommitted of the old segment is already final, so the
+        // link can be published as-is.
+        NanoLogInternal::Fence::sfence();
+        producerSegment->next = next;
+        producerSegment = next;
+        producerOffset = 0;
+        ++numSegmentsAllocated;
+
+        return producerSegment->data;
+    }
+
+    // Segment the producer is currently filling and the offset within it
+    Segment *producerSegment;
+    uint32_t producerOffset;
+
+public:
+    // Number of cycles the producer was blocked waiting on the pool
+    uint64_t cyclesProducerBlocked;
+
+    // Number of Segments the producer has linked into the chain
+    uint64_t numSegmentsAllocated;
+
+private:
+    // Pool that Segments are drawn from and returned to
+    SegmentPool *pool;
+
+    // Separates the producer variables above from the consumer's below
+    char cacheLineSpacer[NanoLogConfig::BYTES_PER_CACHE_LINE];
+
+    // Segment the consumer is currently reading and the offset within it
+    Segment *consumerSegment;
+    uint32_t consumerOffset;
+
+    // Identifier for this buffer
+    uint32_t id;
+};
+
+}; // namespace Alternatives
+
+#endif // SEGMENTEDSTAGINGBUFFER_H
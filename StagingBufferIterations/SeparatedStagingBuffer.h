@@ -17,6 +17,10 @@
 #define RUNTIME_SEPARATEDSTAGINGBUFFER_H
 
 #include <cstdint>
+#include <cstring>
+#include <new>
+
+#include <emmintrin.h>
 
 #include "Config.h"
 #include "PerfUtils/Cycles.h"
@@ -27,6 +31,71 @@ namespace Alternatives {
 template<class T, size_t N>
 constexpr size_t arraySize(T (&)[N]) { return N; }
 
+// Minimum distance between two objects to avoid false sharing, as
+// reported by the compiler when it supports it. GCC warns that the value
+// may change between compiler versions, which doesn't matter here since
+// it never crosses an ABI boundary.
+#ifdef __cpp_lib_hardware_interference_size
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winterference-size"
+static constexpr size_t DESTRUCTIVE_INTERFERENCE_SIZE =
+                                std::hardware_destructive_interference_size;
+#pragma GCC diagnostic pop
+#else
+static constexpr size_t DESTRUCTIVE_INTERFERENCE_SIZE =
+                                NanoLogConfig::BYTES_PER_CACHE_LINE;
+#endif
+
+/**
+ * Layout policies for the StagingBuffer's member variables. Each policy
+ * gives the alignment of the first member of every group of variables
+ * below; an alignment of 1 leaves the member packed against the previous
+ * one, while a cache line size or more starts it on its own line:
+ *  - PRODUCER_ALIGN: producerPos and endOfRecordedSpace, which are written
+ *    by the producer and read by the consumer
+ *  - FREE_SPACE_ALIGN: minFreeSpace, which only the producer touches
+ *  - STATS_ALIGN: the producer statistics, which are written on every
+ *    allocation but read by the consumer only when reporting
+ *  - CONSUMER_ALIGN: consumerPos, which is written by the consumer
+ *  - READ_MOSTLY_ALIGN: shouldDeallocate, id, nextFree and storage, which
+ *    rarely change after construction
+ */
+
+// All members packed; only the CacheLineSpacerBytes knob separates the
+// producer's and consumer's variables. This is the original layout.
+struct SpacerLayout {
+    static constexpr size_t PRODUCER_ALIGN = 1;
+    static constexpr size_t FREE_SPACE_ALIGN = 1;
+    static constexpr size_t STATS_ALIGN = 1;
+    static constexpr size_t CONSUMER_ALIGN = 1;
+    static constexpr size_t READ_MOSTLY_ALIGN = 1;
+};
+
+// Every group, including minFreeSpace, on its own line
+template<size_t LineBytes>
+struct PaddedFieldsLayout {
+    static constexpr size_t PRODUCER_ALIGN = LineBytes;
+    static constexpr size_t FREE_SPACE_ALIGN = LineBytes;
+    static constexpr size_t STATS_ALIGN = LineBytes;
+    static constexpr size_t CONSUMER_ALIGN = LineBytes;
+    static constexpr size_t READ_MOSTLY_ALIGN = LineBytes;
+};
+
+// The producer's hot variables share a line, so the fast path touches
+// only one, and the statistics, consumerPos and read-mostly variables
+// each get their own.
+template<size_t LineBytes>
+struct GroupedLayout {
+    static constexpr size_t PRODUCER_ALIGN = LineBytes;
+    static constexpr size_t FREE_SPACE_ALIGN = 1;
+    static constexpr size_t STATS_ALIGN = LineBytes;
+    static constexpr size_t CONSUMER_ALIGN = LineBytes;
+    static constexpr size_t READ_MOSTLY_ALIGN = LineBytes;
+};
+
+// GroupedLayout spaced by the compiler's false sharing distance
+using InterferenceLayout = GroupedLayout<DESTRUCTIVE_INTERFERENCE_SIZE>;
+
 /**
  * Implements a circular FIFO producer/consumer byte queue that is used
  * to hold the dynamic information of a NanoLog log statement (producer)
@@ -36,8 +105,16 @@ constexpr size_t arraySize(T (&)[N]) { return N; }
  *
  * The implementation is the live version of StagingBuffer that exists
  * in the full NanoLog system.
+ *
+ * \tparam CacheLineSpacerBytes
+ *      Size of the spacer between the producer's and consumer's variables
+ * \tparam Layout
+ *      Policy that aligns the groups of member variables (see SpacerLayout)
+ * \tparam BufferSize
+ *      Number of bytes of storage
  */
-template<int CacheLineSpacerBytes>
+template<int CacheLineSpacerBytes, typename Layout = SpacerLayout,
+         uint32_t BufferSize = NanoLogConfig::STAGING_BUFFER_SIZE>
 class StagingBuffer {
 public:
     /**
@@ -89,6 +166,38 @@ public:
 //        consumerPos.fetch_add(nbytes, std::memory_order_release);
     }
 
+    /**
+     * Estimates the number of bytes waiting to be consumed. Unlike peek(),
+     * this does not modify the consumer's state, so it may be invoked by
+     * threads other than the consumer (e.g. to find a buffer to steal),
+     * but the result may be stale by the time it's returned.
+     *
+     * \return
+     *      Approximate number of bytes produced but not yet consumed
+     */
+    uint64_t
+    getBytesPending() {
+        char *cachedProducerPos = producerPos;
+        char *cachedConsumerPos = consumerPos;
+
+        if (cachedProducerPos >= cachedConsumerPos)
+            return cachedProducerPos - cachedConsumerPos;
+
+        return BufferSize -
+                                    (cachedConsumerPos - cachedProducerPos);
+    }
+
+    /**
+     * Hints the CPU to start loading the cache lines that the next peek()
+     * will read, so a consumer can overlap those misses with work on
+     * another buffer.
+     */
+    inline void
+    prefetchForPeek() {
+        __builtin_prefetch(&producerPos);
+        __builtin_prefetch(const_cast<char**>(&consumerPos));
+    }
+
     /**
      * Returns true if it's safe for the compression thread to delete
      * the StagingBuffer and remove it from the global vector.
@@ -109,7 +218,7 @@ public:
     StagingBuffer(uint32_t bufferId)
         : producerPos(nullptr)
         , endOfRecordedSpace(nullptr)
-        , minFreeSpace(NanoLogConfig::STAGING_BUFFER_SIZE)
+        , minFreeSpace(BufferSize)
         , cyclesProducerBlocked(0)
         , numTimesProducerBlocked(0)
         , numAllocations(0)
@@ -119,15 +228,17 @@ public:
         , cyclesIn10Ns(PerfUtils::Cycles::fromNanoseconds(10))
         , cacheLineSpacer()
         , consumerPos(nullptr)
+        , producerStarved(false)
         , shouldDeallocate(false)
         , id(bufferId)
+        , nextFree(nullptr)
         , storage(nullptr)
     {
-        storage = static_cast<char*>(malloc(NanoLogConfig::STAGING_BUFFER_SIZE));
+        storage = static_cast<char*>(malloc(BufferSize));
         assert(storage);
 
         producerPos = consumerPos = storage;
-        endOfRecordedSpace = storage + NanoLogConfig::STAGING_BUFFER_SIZE;
+        endOfRecordedSpace = storage + BufferSize;
 
 #ifdef RECORD_PRODUCER_STATS
         for (size_t i = 0; i < arraySize(cyclesProducerBlockedDist); ++i)
@@ -144,6 +255,29 @@ public:
         }
     }
 
+    /**
+     * Resets a drained StagingBuffer so that it can be handed to a new
+     * thread without reallocating (and re-faulting) its storage.
+     *
+     * \param bufferId
+     *      New identifier for the StagingBuffer
+     */
+    void
+    recycle(uint32_t bufferId) {
+        assert(consumerPos == producerPos);
+
+        producerPos = consumerPos = storage;
+        endOfRecordedSpace = storage + BufferSize;
+        minFreeSpace = BufferSize;
+        cyclesProducerBlocked = 0;
+        numTimesProducerBlocked = 0;
+        numAllocations = 0;
+        producerStarved = false;
+        shouldDeallocate = false;
+        id = bufferId;
+        nextFree = nullptr;
+    }
+
     public:
 
     /**
@@ -169,7 +303,7 @@ public:
     char*
     reserveSpaceInternal(size_t nbytes, bool blocking= false)
     {
-        const char *endOfBuffer = storage + NanoLogConfig::STAGING_BUFFER_SIZE;
+        const char *endOfBuffer = storage + BufferSize;
 
 #ifdef RECORD_PRODUCER_STATS
         uint64_t start = PerfUtils::Cycles::rdtsc();
@@ -206,6 +340,12 @@ public:
                 minFreeSpace = cachedReadPos - producerPos;
             }
 
+            // Tell a consumer that defers releasing space (see
+            // DeferredReleaseStagingBuffer) to release it now. The check
+            // avoids dirtying the consumer's cache line on every spin.
+            if (minFreeSpace <= nbytes && !producerStarved)
+                producerStarved = true;
+
             // Needed to prevent infinite loops in tests
             if (!blocking && minFreeSpace <= nbytes)
                 return nullptr;
@@ -215,7 +355,7 @@ public:
         uint64_t cyclesBlocked = PerfUtils::Cycles::rdtsc() - start;
     cyclesProducerBlocked += cyclesBlocked;
 
-    size_t maxIndex = Util::arraySize(cyclesProducerBlockedDist) - 1;
+    size_t maxIndex = arraySize(cyclesProducerBlockedDist) - 1;
     size_t index = std::min(cyclesBlocked/cyclesIn10Ns, maxIndex);
     ++(cyclesProducerBlockedDist[index]);
 #endif
@@ -264,7 +404,7 @@ public:
     finishReservation(size_t nbytes) {
         assert(nbytes < minFreeSpace);
         assert(producerPos + nbytes <
-               storage + NanoLogConfig::STAGING_BUFFER_SIZE);
+               storage + BufferSize);
 
         // Ensures producer finishes writes before bump
         NanoLogInternal:: Fence::sfence();
@@ -272,7 +412,152 @@ public:
         producerPos += nbytes;
     }
 
+    /**
+     * Copies nbytes of data into the StagingBuffer and makes it visible to
+     * the consumer, blocking if there's not enough space. Records of at
+     * least nonTemporalThreshold bytes are written with streaming stores
+     * that bypass the producer's caches, since only the consumer will
+     * read them back.
+     *
+     * \param data
+     *      Pointer to the data to copy in
+     * \param nbytes
+     *      Number of bytes to copy from *data
+     * \param nonTemporalThreshold
+     *      Smallest record that is copied with streaming stores
+     */
+    inline void
+    push(const char *data, size_t nbytes,
+         size_t nonTemporalThreshold = NanoLogConfig::NON_TEMPORAL_THRESHOLD)
+    {
+        char *pos = reserveProducerSpace(nbytes);
+
+        if (nbytes >= nonTemporalThreshold)
+            copyNonTemporal(pos, data, nbytes);
+        else
+            std::memcpy(pos, data, nbytes);
+
+        // The sfence here also orders the weakly-ordered streaming stores
+        // before the producerPos bump.
+        finishReservation(nbytes);
+    }
+
+    /**
+     * memcpy() replacement that writes dst with non-temporal (streaming)
+     * stores. The stores are weakly ordered, so the caller must sfence
+     * before publishing the data to another thread.
+     *
+     * \param dst
+     *      Destination of the copy
+     * \param src
+     *      Source of the copy
+     * \param nbytes
+     *      Number of bytes to copy
+     */
+    static inline void
+    copyNonTemporal(char *dst, const char *src, size_t nbytes)
+    {
+        // _mm_stream_si128 requires 16-byte alignment; copy the unaligned
+        // head and tail normally.
+        size_t head = (16 - (reinterpret_cast<uintptr_t>(dst) & 15)) & 15;
+        if (head > nbytes)
+            head = nbytes;
+
+        std::memcpy(dst, src, head);
+        dst += head;
+        src += head;
+        nbytes -= head;
+
+        for (; nbytes >= 16; nbytes -= 16, dst += 16, src += 16) {
+            __m128i chunk = _mm_loadu_si128(
+                                    reinterpret_cast<const __m128i*>(src));
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst), chunk);
+        }
+
+        std::memcpy(dst, src, nbytes);
+    }
+
+    /**
+     * Scoped batch of records that are made visible to the consumer
+     * together, paying for the sfence and the producerPos update once per
+     * batch rather than once per record. Records are reserved and
+     * finished as with the StagingBuffer itself, but nothing is published
+     * until commit() or the end of the Transaction's scope.
+     *
+     * Only one Transaction may be open on a StagingBuffer at a time, and
+     * the StagingBuffer may not be used directly while it's open.
+     */
+    class Transaction {
+    public:
+        explicit Transaction(StagingBuffer &sb)
+            : sb(sb)
+            , bytesPending(0)
+        {
+        }
+
+        ~Transaction() {
+            commit();
+        }
+
+        /**
+         * Reserves contiguous space for the next record in the batch,
+         * behind the records already finished. If there isn't enough
+         * space left before the producer would have to roll over or wait
+         * on the consumer, the records so far are committed first.
+         *
+         * \param nbytes
+         *      Number of bytes to allocate
+         *
+         * \return
+         *      Pointer to at least nbytes of contiguous space
+         */
+        inline char *
+        reserveProducerSpace(size_t nbytes) {
+            ++sb.numAllocations;
+
+            if (bytesPending + nbytes < sb.minFreeSpace)
+                return sb.producerPos + bytesPending;
+
+            commit();
+            return sb.reserveSpaceInternal(nbytes, true);
+        }
+
+        /**
+         * Adds nbytes from the last reserveProducerSpace() to the batch
+         * without exposing them to the consumer.
+         *
+         * \param nbytes
+         *      Number of bytes to add to the batch
+         */
+        inline void
+        finishReservation(size_t nbytes) {
+            assert(bytesPending + nbytes < sb.minFreeSpace);
+            bytesPending += nbytes;
+        }
+
+        /**
+         * Makes all the records finished so far visible to the consumer.
+         */
+        inline void
+        commit() {
+            if (bytesPending == 0)
+                return;
+
+            sb.finishReservation(bytesPending);
+            bytesPending = 0;
+        }
+
+    private:
+        // StagingBuffer the records are reserved from
+        StagingBuffer &sb;
+
+        // Number of bytes finished after producerPos that have yet to
+        // be committed
+        size_t bytesPending;
+    };
+
     // Position within storage[] where the producer may place new data
+    alignas(Layout::PRODUCER_ALIGN) alignas(char*)
     char *producerPos;
 
     // Marks the end of valid data for the consumer. Set by the producer
@@ -281,10 +566,12 @@ public:
 
     // Lower bound on the number of bytes the producer can allocate w/o
     // rolling over the producerPos or stalling behind the consumer
+    alignas(Layout::FREE_SPACE_ALIGN) alignas(uint64_t)
     uint64_t minFreeSpace;
 
     // Number of cycles producer was blocked while waiting for space to
     // free up in the StagingBuffer for an allocation.
+    alignas(Layout::STATS_ALIGN) alignas(uint64_t)
     uint64_t cyclesProducerBlocked;
 
     // Number of times the producer was blocked while waiting for space
@@ -313,23 +600,332 @@ public:
 
     // Position within the storage buffer where the consumer will consume
     // the next bytes from. This value is only updated by the consumer.
+    alignas(Layout::CONSUMER_ALIGN) alignas(char*)
     char *volatile consumerPos;
 
+    // Set by the producer when it's blocked waiting for space and cleared
+    // by a consumer that batches its consumerPos updates once it releases
+    // the space it has consumed.
+    volatile bool producerStarved;
+
     // Indicates that the thread owning this StagingBuffer has been
     // destructed (i.e. no more messages will be logged to it) and thus
     // should be cleaned up once the buffer has been emptied by the
     // compression thread.
+    alignas(Layout::READ_MOSTLY_ALIGN)
     bool shouldDeallocate;
 
     // Uniquely identifies this StagingBuffer for this execution. It's
     // similar to ThreadId, but is only assigned to threads that NANO_LOG).
     uint32_t id;
 
+    // Links the StagingBuffer into a FreeList while it waits to be recycled
+    StagingBuffer *nextFree;
+
     // Backing store used to implement the circular queue
     char *storage;
 //    char storage[NanoLogConfig::STAGING_BUFFER_SIZE];
 };
 
+/**
+ * StagingBuffer whose consumer releases consumed space back to the producer
+ * in batches. The consumer advances a private cursor on every consume() and
+ * only publishes it to consumerPos once ReleaseThreshold bytes have
+ * accumulated, or sooner if the producer has flagged that it's blocked on
+ * space. This trades producer stalls (the producer sees less free space)
+ * for fewer writes to the cache line that the producer reads on its slow
+ * path.
+ *
+ * The producer side is unchanged. The consumer must use the peek() and
+ * consume() below rather than the StagingBuffer's.
+ *
+ * \tparam ReleaseThreshold
+ *      Number of consumed bytes to accumulate before publishing them; 0
+ *      publishes on every consume() like the StagingBuffer
+ * \tparam CacheLineSpacerBytes
+ *      See StagingBuffer
+ */
+template<uint64_t ReleaseThreshold = NanoLogConfig::RELEASE_THRESHOLD,
+         int CacheLineSpacerBytes = 64>
+class DeferredReleaseStagingBuffer
+        : public StagingBuffer<CacheLineSpacerBytes> {
+    using Base = StagingBuffer<CacheLineSpacerBytes>;
+
+public:
+    DeferredReleaseStagingBuffer(uint32_t bufferId)
+        : Base(bufferId)
+        , consumerCursor(this->storage)
+        , bytesUnreleased(0)
+        , numReleases(0)
+        , numStarvedReleases(0)
+    {
+    }
+
+    /**
+     * Peek at the data available for consumption starting from the
+     * consumer's private cursor (see StagingBuffer::peek()). If there's
+     * nothing left to consume but the producer is waiting on space, the
+     * space consumed so far is released, since no consume() may come
+     * to do it.
+     *
+     * \param[out] bytesAvailable
+     *      Number of bytes consumable
+     * \return
+     *      Pointer to the consumable space
+     */
+    char *
+    peek(uint64_t *bytesAvailable) {
+        char *cachedRecordHead = this->producerPos;
+
+        if (cachedRecordHead < consumerCursor) {
+            NanoLogInternal::Fence::lfence();
+            *bytesAvailable = this->endOfRecordedSpace - consumerCursor;
+
+            if (*bytesAvailable > 0)
+                return consumerCursor;
+
+            // Roll over privately; the producer still sees the old
+            // consumerPos until the next release.
+            consumerCursor = this->storage;
+        }
+
+        *bytesAvailable = cachedRecordHead - consumerCursor;
+        if (*bytesAvailable == 0 && bytesUnreleased > 0 &&
+                this->producerStarved) {
+            ++numStarvedReleases;
+            releaseConsumedSpace();
+        }
+
+        return consumerCursor;
+    }
+
+    /**
+     * Consumes the next nbytes after the consumer's cursor, releasing them
+     * and everything consumed before them to the producer once enough have
+     * accumulated or the producer is starved.
+     *
+     * \param nbytes
+     *      Number of bytes consumed
+     */
+    inline void
+    consume(uint64_t nbytes) {
+        consumerCursor += nbytes;
+        bytesUnreleased += nbytes;
+
+        if (bytesUnreleased >= ReleaseThreshold) {
+            releaseConsumedSpace();
+        } else if (this->producerStarved) {
+            ++numStarvedReleases;
+            releaseConsumedSpace();
+        }
+    }
+
+    /**
+     * Publishes the consumer's cursor to the producer, e.g. before the
+     * consumer goes idle or checks whether the buffer can be deleted.
+     */
+    inline void
+    releaseConsumedSpace() {
+        // Make sure consumer reads finish before the producer can reuse
+        // the space
+        NanoLogInternal::Fence::lfence();
+        this->consumerPos = consumerCursor;
+        this->producerStarved = false;
+        bytesUnreleased = 0;
+        ++numReleases;
+    }
+
+    // Number of times consumerPos was published to the producer
+    uint64_t
+    getNumReleases() {
+        return numReleases;
+    }
+
+    // Number of the above that were forced early by a starved producer
+    uint64_t
+    getNumStarvedReleases() {
+        return numStarvedReleases;
+    }
+
+private:
+    // Consumer's private position; consumerPos trails it by
+    // bytesUnreleased (modulo the roll over)
+    char *consumerCursor;
+
+    // Bytes consumed since consumerPos was last published
+    uint64_t bytesUnreleased;
+
+    // Number of times consumerPos was published
+    uint64_t numReleases;
+
+    // Number of releases made before reaching ReleaseThreshold because the
+    // producer was starved
+    uint64_t numStarvedReleases;
+};
+
+/**
+ * StagingBuffer whose producer batches its producerPos updates without the
+ * caller's involvement (unlike StagingBuffer::Transaction). Finished records
+ * accumulate behind the producer's private cursor and are published
+ * together once any of the triggers below fires, so the consumer pulls the
+ * producer's cache line once per batch instead of once per record.
+ *
+ * The triggers are only checked when the producer finishes a record, so a
+ * producer that stops logging must flush() to bound the delay of its last
+ * records.
+ *
+ * \tparam RecordsPerPublish
+ *      Publish after this many unpublished records; 0 disables
+ * \tparam BytesPerPublish
+ *      Publish after this many unpublished bytes; 0 disables
+ * \tparam DeadlineNs
+ *      Publish once the oldest unpublished record is this old; 0 disables
+ * \tparam CacheLineSpacerBytes
+ *      See StagingBuffer
+ */
+template<uint32_t RecordsPerPublish = NanoLogConfig::LAZY_PUBLISH_RECORDS,
+         uint32_t BytesPerPublish = NanoLogConfig::LAZY_PUBLISH_BYTES,
+         uint32_t DeadlineNs = NanoLogConfig::LAZY_PUBLISH_DEADLINE_NS,
+         int CacheLineSpacerBytes = 64>
+class LazyPublishStagingBuffer
+        : public StagingBuffer<CacheLineSpacerBytes> {
+    using Base = StagingBuffer<CacheLineSpacerBytes>;
+
+public:
+    LazyPublishStagingBuffer(uint32_t bufferId)
+        : Base(bufferId)
+        , bytesUnpublished(0)
+        , recordsUnpublished(0)
+        , publishDeadline(0)
+        , deadlineCycles(PerfUtils::Cycles::fromNanoseconds(DeadlineNs))
+        , numPublishes(0)
+    {
+    }
+
+    /**
+     * Reserves contiguous space for the next record behind the ones not
+     * yet published (see StagingBuffer::reserveProducerSpace()). If that
+     * requires waiting on the consumer or rolling over, the unpublished
+     * records are published first so the consumer can free up the space.
+     *
+     * \param nbytes
+     *      Number of bytes to allocate
+     *
+     * \return
+     *      Pointer to at least nbytes of contiguous space
+     */
+    inline char *
+    reserveProducerSpace(size_t nbytes) {
+        ++this->numAllocations;
+
+        if (bytesUnpublished + nbytes < this->minFreeSpace)
+            return this->producerPos + bytesUnpublished;
+
+        flush();
+        return this->reserveSpaceInternal(nbytes, true);
+    }
+
+    /**
+     * Finishes the last reservation and publishes it along with the other
+     * unpublished records if a trigger has fired.
+     *
+     * \param nbytes
+     *      Number of bytes the record occupies
+     */
+    inline void
+    finishReservation(size_t nbytes) {
+        assert(bytesUnpublished + nbytes < this->minFreeSpace);
+        bytesUnpublished += nbytes;
+        ++recordsUnpublished;
+
+        if (RecordsPerPublish > 0 && recordsUnpublished >= RecordsPerPublish) {
+            flush();
+            return;
+        }
+
+        if (BytesPerPublish > 0 && bytesUnpublished >= BytesPerPublish) {
+            flush();
+            return;
+        }
+
+        if (DeadlineNs > 0) {
+            uint64_t now = PerfUtils::Cycles::rdtsc();
+            if (recordsUnpublished == 1)
+                publishDeadline = now + deadlineCycles;
+            else if (now >= publishDeadline)
+                flush();
+        }
+    }
+
+    /**
+     * One-stage push through the lazy reserveProducerSpace() and
+     * finishReservation() above, which the base class' push() would
+     * bypass. See StagingBuffer::push().
+     *
+     * \param data
+     *      Pointer to the data to copy in
+     * \param nbytes
+     *      Number of bytes to copy from *data
+     * \param nonTemporalThreshold
+     *      Smallest record that is copied with streaming stores
+     */
+    inline void
+    push(const char *data, size_t nbytes,
+         size_t nonTemporalThreshold = NanoLogConfig::NON_TEMPORAL_THRESHOLD)
+    {
+        char *pos = reserveProducerSpace(nbytes);
+
+        if (nbytes >= nonTemporalThreshold)
+            Base::copyNonTemporal(pos, data, nbytes);
+        else
+            std::memcpy(pos, data, nbytes);
+
+        // The streaming stores are fenced when the record is published.
+        finishReservation(nbytes);
+    }
+
+    /**
+     * Makes all the finished records visible to the consumer.
+     */
+    inline void
+    flush() {
+        if (bytesUnpublished == 0)
+            return;
+
+        Base::finishReservation(bytesUnpublished);
+        bytesUnpublished = 0;
+        recordsUnpublished = 0;
+        ++numPublishes;
+    }
+
+    // Number of times producerPos was published to the consumer
+    uint64_t
+    getNumPublishes() {
+        return numPublishes;
+    }
+
+private:
+    // The Transaction commits straight to the base class and would
+    // overwrite the unpublished records; batching is built in instead
+    using typename Base::Transaction;
+
+    // Number of bytes finished after producerPos that have yet to be
+    // published
+    size_t bytesUnpublished;
+
+    // Number of records making up bytesUnpublished
+    uint32_t recordsUnpublished;
+
+    // Cycle count by which the oldest unpublished record should be published
+    uint64_t publishDeadline;
+
+    // DeadlineNs converted to cycles
+    uint64_t deadlineCycles;
+
+    // Number of times producerPos was published
+    uint64_t numPublishes;
+};
+
 }; // Namespace alternatives
 
 
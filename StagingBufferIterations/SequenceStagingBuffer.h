@@ -0,0 +1,212 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SEQUENCESTAGINGBUFFER_H
+#define SEQUENCESTAGINGBUFFER_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+
+#include "Config.h"
+#include "Fence.h"
+
+namespace Alternatives {
+
+/**
+ * Single producer, single consumer StagingBuffer that tracks its positions
+ * as free-running 64-bit sequence numbers (bytes written and read since
+ * the buffer was created) rather than pointers into storage. A position
+ * maps to storage by masking with the power-of-two size, and the bytes in
+ * use are simply producerSeq - consumerSeq, so telling a full buffer from
+ * an empty one needs no <= tricks and the whole buffer can be filled.
+ *
+ * The price is that records are framed: each starts with a RecordHeader
+ * holding its length. A record that doesn't fit before the end of storage
+ * is preceded by a skip record covering the rest of the lap, so the
+ * consumer learns where the producer wrapped around from the data itself
+ * and needs no shared endOfRecordedSpace. A skip record is always the last
+ * one in a region returned by peek(), since its padding runs to the end of
+ * storage.
+ */
+class SequenceStagingBuffer {
+public:
+    // Precedes every record; records are 4-byte aligned
+    struct RecordHeader {
+        // Number of bytes of data that follow, or SKIP
+        uint32_t length;
+    };
+
+    // RecordHeader::length of a record that pads out the end of storage
+    static constexpr uint32_t SKIP = 0xFFFFFFFF;
+
+    // Number of bytes a record with nbytes of data occupies
+    static constexpr uint64_t
+    recordSize(uint32_t nbytes) {
+        return (sizeof(RecordHeader) + nbytes + 3) & ~uint64_t(3);
+    }
+
+    explicit SequenceStagingBuffer(uint32_t id)
+        : producerSeq(0)
+        , cachedConsumerSeq(0)
+        , reservedPadding(0)
+        , consumerSeq(0)
+        , id(id)
+        , storage(static_cast<char*>(malloc(SIZE)))
+    {
+        assert(storage);
+    }
+
+    ~SequenceStagingBuffer() {
+        free(storage);
+    }
+
+    SequenceStagingBuffer(const SequenceStagingBuffer&) = delete;
+    SequenceStagingBuffer& operator=(const SequenceStagingBuffer&) = delete;
+
+    /**
+     * Reserves space for a record without making it visible to the
+     * consumer, blocking behind the consumer if there's not enough space.
+     * The caller should invoke finishReservation() before invoking
+     * reserveProducerSpace() again.
+     *
+     * \param nbytes
+     *      Number of bytes of data the record will hold
+     * \return
+     *      Pointer to nbytes of contiguous space for the record's data
+     */
+    inline char *
+    reserveProducerSpace(uint32_t nbytes) {
+        const uint64_t size = recordSize(nbytes);
+        const uint64_t offset = producerSeq & (SIZE - 1);
+        const uint64_t padding = (offset + size > SIZE) ? SIZE - offset : 0;
+
+        if (producerSeq + padding + size - cachedConsumerSeq > SIZE)
+            waitForSpace(padding + size);
+
+        // The consumer reads nothing past producerSeq, so the skip record
+        // may be written ahead of publishing it with the record
+        if (padding != 0)
+            headerAt(producerSeq)->length = SKIP;
+
+        reservedPadding = padding;
+        return reinterpret_cast<char*>(headerAt(producerSeq + padding) + 1);
+    }
+
+    /**
+     * Makes the record reserved by the last reserveProducerSpace() (and the
+     * skip record before it, if any) visible to the consumer.
+     *
+     * \param nbytes
+     *      Number of bytes of data in the record
+     */
+    inline void
+    finishReservation(uint32_t nbytes) {
+        uint64_t start = producerSeq + reservedPadding;
+        headerAt(start)->length = nbytes;
+
+        // Ensures producer finishes writes before bump
+        NanoLogInternal::Fence::sfence();
+        producerSeq = start + recordSize(nbytes);
+    }
+
+    /**
+     * Peek at the records available for consumption. The region holds
+     * whole records back to back and may end with a skip record, after
+     * which the rest of the region is padding.
+     *
+     * \param[out] bytesAvailable
+     *      Number of contiguous bytes available from the pointer returned
+     * \return
+     *      Pointer to the first record available
+     */
+    inline char *
+    peek(uint64_t *bytesAvailable) {
+        uint64_t available = producerSeq - consumerSeq;
+
+        // Prevent reading the records before producerSeq
+        NanoLogInternal::Fence::lfence();
+
+        uint64_t offset = consumerSeq & (SIZE - 1);
+        *bytesAvailable = std::min(available, SIZE - offset);
+        return storage + offset;
+    }
+
+    /**
+     * Consumes the next nbytes (whole records) returned by peek()
+     *
+     * \param nbytes
+     *      Number of bytes to consume
+     */
+    inline void
+    consume(uint64_t nbytes) {
+        // Make sure consumer reads finish before bump
+        NanoLogInternal::Fence::lfence();
+        consumerSeq += nbytes;
+    }
+
+    uint32_t getId() {
+        return id;
+    }
+
+private:
+    // Bytes of storage; a power of 2
+    static const uint64_t SIZE = NanoLogConfig::STAGING_BUFFER_SIZE;
+    static_assert((SIZE & (SIZE - 1)) == 0, "SIZE must be a power of 2");
+
+    // Returns the header of the record at sequence seq
+    inline RecordHeader *
+    headerAt(uint64_t seq) {
+        return reinterpret_cast<RecordHeader*>(storage + (seq & (SIZE - 1)));
+    }
+
+    /**
+     * Slow path of reserveProducerSpace(): spins until the consumer has
+     * freed nbytes past producerSeq.
+     */
+    void
+    waitForSpace(uint64_t nbytes) {
+        assert(nbytes <= SIZE);
+
+        do {
+            cachedConsumerSeq = consumerSeq;
+        } while (producerSeq + nbytes - cachedConsumerSeq > SIZE);
+    }
+
+    // Sequence up to which (exclusive) the producer has published records
+    volatile uint64_t producerSeq;
+
+    // Producer's last read of consumerSeq
+    uint64_t cachedConsumerSeq;
+
+    // Bytes of skip record before the reserved record
+    uint64_t reservedPadding;
+
+    // Sequence up to which (exclusive) the consumer has consumed records
+    alignas(NanoLogConfig::BYTES_PER_CACHE_LINE)
+    volatile uint64_t consumerSeq;
+
+    // User-assigned identifier for this buffer
+    alignas(NanoLogConfig::BYTES_PER_CACHE_LINE)
+    uint32_t id;
+
+    // Backing store used to implement the circular queue
+    char *storage;
+};
+
+}; // namespace Alternatives
+
+#endif // SEQUENCESTAGINGBUFFER_H
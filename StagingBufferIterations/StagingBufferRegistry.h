@@ -0,0 +1,230 @@
+/* Copyright (c) 2019 Stanford University
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR(S) DISCLAIM ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL AUTHORS BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef STAGINGBUFFERREGISTRY_H
+#define STAGINGBUFFERREGISTRY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "Fence.h"
+#include "FreeList.h"
+
+namespace Alternatives {
+
+/**
+ * Keeps track of the thread-local StagingBuffers in the same way the
+ * NanoLog RuntimeLogger does. A thread's StagingBuffer is allocated lazily
+ * on its first log invocation and marked for deallocation when the thread
+ * exits. The consumer then reclaims the buffer once it has been drained.
+ *
+ * There's one registry per Buffer type so that the different StagingBuffer
+ * implementations can be benchmarked side by side.
+ *
+ * \tparam Pooled
+ *      When true, reclaimed StagingBuffers are placed in a lock-free
+ *      FreeList and handed to new threads instead of being deleted, so
+ *      thread churn doesn't reallocate and re-fault the buffer storage.
+ */
+template<typename Buffer, bool Pooled = false>
+class StagingBufferRegistry {
+public:
+    /**
+     * Returns the calling thread's StagingBuffer, allocating it if this is
+     * the thread's first invocation.
+     */
+    static inline Buffer *
+    getStagingBuffer() {
+        if (stagingBuffer == nullptr)
+            ensureStagingBufferAllocated();
+
+        return stagingBuffer;
+    }
+
+    /**
+     * Makes one pass over all the registered StagingBuffers processing the
+     * data available in each, and reclaims the buffers whose threads have
+     * exited and that have been fully drained. Only one thread may
+     * invoke this function at a time.
+     *
+     * \param process
+     *      Callable invoked as process(char *data, uint64_t bytes) on each
+     *      contiguous region peek()-ed. It returns the number of bytes it
+     *      processed, which will be consume()-ed.
+     * \return
+     *      Number of bytes consumed
+     */
+    template<typename Fn>
+    static uint64_t
+    drain(Fn &&process) {
+        uint64_t bytesConsumed = 0;
+        std::unique_lock<std::mutex> lock(bufferMutex);
+
+        size_t i = 0;
+        while (i < threadBuffers.size()) {
+            Buffer *sb = threadBuffers[i];
+
+            // Drop the lock while processing so that new threads are
+            // not blocked behind the consumer.
+            lock.unlock();
+            uint64_t bytesAvail;
+            char *data = sb->peek(&bytesAvail);
+            if (bytesAvail > 0) {
+                uint64_t processed = process(data, bytesAvail);
+                sb->consume(processed);
+                bytesConsumed += processed;
+            }
+            lock.lock();
+
+            if (sb->shouldDeallocate) {
+                // Ensures we read the producer's final producerPos
+                NanoLogInternal::Fence::lfence();
+
+                if (sb->checkCanDelete()) {
+                    threadBuffers.erase(threadBuffers.begin() + i);
+                    if (Pooled)
+                        freeBuffers.push(sb);
+                    else
+                        delete sb;
+
+                    ++numBuffersReclaimed;
+                    continue;
+                }
+            }
+
+            ++i;
+        }
+
+        return bytesConsumed;
+    }
+
+    // Number of StagingBuffers currently registered
+    static size_t
+    getNumBuffers() {
+        std::lock_guard<std::mutex> _(bufferMutex);
+        return threadBuffers.size();
+    }
+
+    // Largest number of StagingBuffers registered at once
+    static size_t
+    getMaxNumBuffers() {
+        std::lock_guard<std::mutex> _(bufferMutex);
+        return maxNumBuffers;
+    }
+
+    // Number of StagingBuffers deleted after their threads exited
+    static uint64_t
+    getNumBuffersReclaimed() {
+        std::lock_guard<std::mutex> _(bufferMutex);
+        return numBuffersReclaimed;
+    }
+
+    // Number of StagingBuffers allocated with new (i.e. not recycled)
+    static uint64_t
+    getNumBuffersAllocated() {
+        std::lock_guard<std::mutex> _(bufferMutex);
+        return numBuffersAllocated;
+    }
+
+    /**
+     * Resets the statistics kept by the registry. Should only be invoked
+     * when no StagingBuffers are registered.
+     */
+    static void
+    resetStats() {
+        std::lock_guard<std::mutex> _(bufferMutex);
+        maxNumBuffers = threadBuffers.size();
+        numBuffersReclaimed = 0;
+        numBuffersAllocated = 0;
+    }
+
+private:
+    /**
+     * Marks the thread's StagingBuffer for deallocation when the thread
+     * exits. An instance lives in thread-local storage so that its
+     * destructor is invoked as part of thread teardown.
+     */
+    struct StagingBufferDestroyer {
+        explicit StagingBufferDestroyer() {
+        }
+
+        // Invoked once per thread to force the construction of this
+        // thread_local object (and thus the registration of its destructor)
+        void stagingBufferCreated() {
+        }
+
+        virtual ~StagingBufferDestroyer() {
+            if (stagingBuffer != nullptr) {
+                // Make sure the final producerPos is visible first
+                NanoLogInternal::Fence::sfence();
+                stagingBuffer->shouldDeallocate = true;
+                stagingBuffer = nullptr;
+            }
+        }
+    };
+
+    /**
+     * Allocates and registers the calling thread's StagingBuffer. This
+     * is the slow path of getStagingBuffer().
+     */
+    static void
+    ensureStagingBufferAllocated() {
+        Buffer *recycled = (Pooled) ? freeBuffers.pop() : nullptr;
+
+        std::lock_guard<std::mutex> _(bufferMutex);
+        if (recycled) {
+            recycled->recycle(nextBufferId++);
+            stagingBuffer = recycled;
+        } else {
+            stagingBuffer = new Buffer(nextBufferId++);
+            ++numBuffersAllocated;
+        }
+
+        threadBuffers.push_back(stagingBuffer);
+        maxNumBuffers = std::max(maxNumBuffers, threadBuffers.size());
+
+        sbc.stagingBufferCreated();
+    }
+
+    // Protects the variables below
+    static inline std::mutex bufferMutex;
+
+    // StagingBuffers of threads that have logged (and haven't been
+    // reclaimed yet)
+    static inline std::vector<Buffer*> threadBuffers;
+
+    // Identifier to assign to the next StagingBuffer allocated
+    static inline uint32_t nextBufferId = 0;
+
+    // Statistics for the benchmarks (see getters above)
+    static inline size_t maxNumBuffers = 0;
+    static inline uint64_t numBuffersReclaimed = 0;
+    static inline uint64_t numBuffersAllocated = 0;
+
+    // Drained StagingBuffers waiting to be reused (if Pooled)
+    static inline FreeList<Buffer> freeBuffers;
+
+    // The calling thread's StagingBuffer or nullptr if not yet allocated
+    static inline thread_local Buffer *stagingBuffer = nullptr;
+
+    // Marks stagingBuffer for deallocation when the thread exits
+    static inline thread_local StagingBufferDestroyer sbc;
+};
+
+}; // namespace Alternatives
+
+#endif // STAGINGBUFFERREGISTRY_H
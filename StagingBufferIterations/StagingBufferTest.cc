@@ -14,9 +14,16 @@
  */
 
 #include <cstring>
+#include <thread>
+#include <vector>
 
 #include "gtest/gtest.h"
 
+#include "HybridStagingBufferRegistry.h"
+#include "Locks.h"
+#include "MpscStagingBuffer.h"
+#include "SeparatedStagingBuffer.h"
+#include "SequenceStagingBuffer.h"
 #include "StagingBuffers.h"
 
 namespace {
@@ -62,7 +69,7 @@ TEST_F(StagingBufferTest, BasicBasic) {
     StagingBuffers::Basic basic(0);
     char buffer[100];
 
-    bzero(basic.buffer, StagingBuffers::STAGING_BUFFER_BYTES);
+    bzero(basic.buffer, NanoLogConfig::STAGING_BUFFER_SIZE);
     bzero(buffer, 100);
 
     int bytesAvail;
@@ -125,7 +132,7 @@ TEST_F(StagingBufferTest, BasicBasic) {
 
     // When we try to enqueue something large and the buffer is empty, try roll
     ASSERT_FALSE(basic.push(basic.buffer,
-                            StagingBuffers::STAGING_BUFFER_BYTES  + 1));
+                            NanoLogConfig::STAGING_BUFFER_SIZE  + 1));
     EXPECT_EQ(25, basic.readPos);
     EXPECT_EQ(0, basic.writePos);
     EXPECT_EQ(0, basic.bytesReadable);
@@ -135,22 +142,22 @@ TEST_F(StagingBufferTest, BasicBasic) {
     EXPECT_EQ(0, bytesAvail);
 
     // Now let's fill the buffers
-    EXPECT_TRUE(basic.push(basic.buffer, StagingBuffers::STAGING_BUFFER_BYTES));
+    EXPECT_TRUE(basic.push(basic.buffer, NanoLogConfig::STAGING_BUFFER_SIZE));
     EXPECT_FALSE(basic.push(buffer, 1));
 
     EXPECT_EQ(basic.buffer, basic.peek(bytesAvail));
-    EXPECT_EQ(StagingBuffers::STAGING_BUFFER_BYTES, bytesAvail);
+    EXPECT_EQ(NanoLogConfig::STAGING_BUFFER_SIZE, bytesAvail);
 
     // Eat a little and try to push more.
     basic.pop(50);
     EXPECT_EQ(basic.buffer + 50, basic.peek(bytesAvail));
-    EXPECT_EQ(StagingBuffers::STAGING_BUFFER_BYTES - 50, bytesAvail);
+    EXPECT_EQ(NanoLogConfig::STAGING_BUFFER_SIZE - 50, bytesAvail);
 
     EXPECT_FALSE(basic.push(buffer, 51));
     EXPECT_EQ(50, basic.readPos);
     EXPECT_EQ(0, basic.writePos);
     EXPECT_EQ(bytesAvail, basic.bytesReadable);
-    EXPECT_EQ(StagingBuffers::STAGING_BUFFER_BYTES, basic.endOfWrittenSpace);
+    EXPECT_EQ(NanoLogConfig::STAGING_BUFFER_SIZE, basic.endOfWrittenSpace);
 
     EXPECT_TRUE(basic.push(buffer, 20));
     EXPECT_FALSE(basic.push(buffer, 31));
@@ -162,17 +169,17 @@ TEST_F(StagingBufferTest, BasicBasic) {
 
     // Last test, try to have a straddled roll-over
     basic.readPos = 100;
-    basic.writePos = StagingBuffers::STAGING_BUFFER_BYTES - 50;
-    basic.bytesReadable = StagingBuffers::STAGING_BUFFER_BYTES - 150;
+    basic.writePos = NanoLogConfig::STAGING_BUFFER_SIZE - 50;
+    basic.bytesReadable = NanoLogConfig::STAGING_BUFFER_SIZE - 150;
     basic.endOfWrittenSpace = 0;
 
     ASSERT_TRUE(basic.push(buffer, 75));
 
     EXPECT_EQ(100, basic.readPos);
     EXPECT_EQ(75, basic.writePos);
-    EXPECT_EQ(StagingBuffers::STAGING_BUFFER_BYTES - 75,
+    EXPECT_EQ(NanoLogConfig::STAGING_BUFFER_SIZE - 75,
                 basic.bytesReadable);
-    EXPECT_EQ(StagingBuffers::STAGING_BUFFER_BYTES - 50,
+    EXPECT_EQ(NanoLogConfig::STAGING_BUFFER_SIZE - 50,
                 basic.endOfWrittenSpace);
 }
 
@@ -193,4 +200,423 @@ TEST_F(StagingBufferTest, BasicHalfTester) {
     EXPECT_EQ(3, basic.bytesPopped);
 }
 
+TEST_F(StagingBufferTest, BasicReserveProducerSpace) {
+    StagingBuffers::Basic basic(0);
+    int bytesAvail;
+
+    // Outstanding reservations are invisible to the consumer
+    char *first = basic.reserveProducerSpace(10);
+    char *second = basic.reserveProducerSpace(5);
+    EXPECT_EQ(basic.buffer, first);
+    EXPECT_EQ(basic.buffer + 10, second);
+    EXPECT_EQ(15, basic.writePos);
+    EXPECT_EQ(2, basic.reservations.count);
+
+    EXPECT_EQ(basic.buffer, basic.peek(bytesAvail));
+    EXPECT_EQ(0, bytesAvail);
+
+    // ... as is anything push()-ed behind them
+    EXPECT_TRUE(basic.push("abcd", 5));
+    basic.peek(bytesAvail);
+    EXPECT_EQ(0, bytesAvail);
+
+    // Finishing the younger one first exposes nothing until the older one
+    // finishes too
+    std::memcpy(second, "1234", 5);
+    basic.finishReservation(second, 5);
+    basic.peek(bytesAvail);
+    EXPECT_EQ(0, bytesAvail);
+
+    std::memcpy(first, "123456789", 10);
+    basic.finishReservation(first, 10);
+    const char *eatMe = basic.peek(bytesAvail);
+    EXPECT_EQ(20, bytesAvail);
+    EXPECT_EQ(20, basic.bytesReadable);
+    EXPECT_EQ(20, basic.bytesPushed);
+    EXPECT_STREQ("123456789", eatMe);
+    EXPECT_STREQ("1234", eatMe + 10);
+    EXPECT_STREQ("abcd", eatMe + 15);
+
+    // Data before a reservation remains consumable
+    basic.pop(10);
+    char *third = basic.reserveProducerSpace(8);
+    EXPECT_EQ(basic.buffer + 20, third);
+    EXPECT_EQ(basic.buffer + 10, basic.peek(bytesAvail));
+    EXPECT_EQ(10, bytesAvail);
+    basic.pop(10);
+
+    basic.finishReservation(third, 8);
+    EXPECT_EQ(basic.buffer + 20, basic.peek(bytesAvail));
+    EXPECT_EQ(8, bytesAvail);
+    basic.pop(8);
+
+    // Reservations fail without a space and roll over like push()
+    EXPECT_EQ(nullptr, basic.reserveProducerSpace(
+                                NanoLogConfig::STAGING_BUFFER_SIZE + 1));
+    EXPECT_EQ(0, basic.reservations.count);
+
+    basic.readPos = 100;
+    basic.writePos = NanoLogConfig::STAGING_BUFFER_SIZE - 50;
+    basic.bytesReadable = NanoLogConfig::STAGING_BUFFER_SIZE - 150;
+    basic.endOfWrittenSpace = 0;
+
+    EXPECT_EQ(basic.buffer, basic.reserveProducerSpace(75));
+    EXPECT_EQ(75, basic.writePos);
+    EXPECT_EQ(NanoLogConfig::STAGING_BUFFER_SIZE - 50,
+                basic.endOfWrittenSpace);
+
+    // The part before the roll-over is still readable
+    EXPECT_EQ(basic.buffer + 100, basic.peek(bytesAvail));
+    EXPECT_EQ(NanoLogConfig::STAGING_BUFFER_SIZE - 150, bytesAvail);
+    basic.pop(bytesAvail);
+
+    EXPECT_EQ(basic.buffer, basic.peek(bytesAvail));
+    EXPECT_EQ(0, bytesAvail);
+
+    basic.finishReservation(basic.buffer, 75);
+    EXPECT_EQ(basic.buffer, basic.peek(bytesAvail));
+    EXPECT_EQ(75, bytesAvail);
+}
+
+TEST_F(StagingBufferTest, BasicSpinLockReserveProducerSpace) {
+    StagingBuffers::BasicSpinLock spin(0);
+    int bytesAvail;
+
+    char *first = spin.reserveProducerSpace(10);
+    EXPECT_EQ(spin.buffer, first);
+    EXPECT_TRUE(spin.push("abcd", 5));
+
+    spin.peek(bytesAvail);
+    EXPECT_EQ(0, bytesAvail);
+
+    std::memcpy(first, "123456789", 10);
+    spin.finishReservation(first, 10);
+
+    const char *eatMe = spin.peek(bytesAvail);
+    EXPECT_EQ(15, bytesAvail);
+    EXPECT_EQ(0, spin.reservations.count);
+    EXPECT_STREQ("123456789", eatMe);
+    EXPECT_STREQ("abcd", eatMe + 10);
+}
+
+TEST_F(StagingBufferTest, BasicInterleavedReservations) {
+    StagingBuffers::Basic basic(0);
+    int bytesAvail;
+
+    // As two producers would: the older reservation finishes first and
+    // becomes readable while the younger one is still being filled in
+    char *first = basic.reserveProducerSpace(10);
+    char *second = basic.reserveProducerSpace(5);
+
+    std::memcpy(first, "123456789", 10);
+    basic.finishReservation(first, 10);
+
+    const char *eatMe = basic.peek(bytesAvail);
+    EXPECT_EQ(10, bytesAvail);
+    EXPECT_EQ(1, basic.reservations.count);
+    EXPECT_STREQ("123456789", eatMe);
+    basic.pop(bytesAvail);
+
+    // A third reservation made meanwhile doesn't hold back the second
+    char *third = basic.reserveProducerSpace(8);
+    std::memcpy(second, "abcd", 5);
+    basic.finishReservation(second, 5);
+
+    eatMe = basic.peek(bytesAvail);
+    EXPECT_EQ(5, bytesAvail);
+    EXPECT_STREQ("abcd", eatMe);
+    basic.pop(bytesAvail);
+
+    basic.finishReservation(third, 8);
+    EXPECT_EQ(third, basic.peek(bytesAvail));
+    EXPECT_EQ(8, bytesAvail);
+    EXPECT_EQ(0, basic.reservations.count);
+
+    // Reservations fail once too many are outstanding
+    for (int i = 0; i < NanoLogConfig::MAX_RESERVATIONS; ++i)
+        ASSERT_NE(nullptr, basic.reserveProducerSpace(1));
+    EXPECT_EQ(nullptr, basic.reserveProducerSpace(1));
+}
+
+// Has several threads push() into one shared buffer concurrently and
+// checks that no push was lost or torn by a broken lock.
+template<typename Buffer>
+void
+concurrentPushes()
+{
+    const int numThreads = 4;
+    const int pushesPerThread = 1000;
+    Buffer locked(0);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&locked, i]() {
+            char record[8];
+            std::memset(record, 'a' + i, sizeof(record));
+            for (int j = 0; j < pushesPerThread; ++j)
+                ASSERT_TRUE(locked.push(record, sizeof(record)));
+        });
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    int bytesAvail;
+    const char *data = locked.peek(bytesAvail);
+    ASSERT_EQ(numThreads*pushesPerThread*8, bytesAvail);
+    EXPECT_EQ(bytesAvail, locked.bytesPushed);
+
+    for (int i = 0; i < bytesAvail; i += 8)
+        for (int j = 1; j < 8; ++j)
+            ASSERT_EQ(data[i], data[i + j]);
+
+    locked.pop(bytesAvail);
+    EXPECT_EQ(bytesAvail, locked.bytesPopped);
+}
+
+TEST_F(StagingBufferTest, BasicLockedConcurrentPushes) {
+    using StagingBuffers::BasicLocked;
+    concurrentPushes<BasicLocked<std::mutex>>();
+    concurrentPushes<BasicLocked<Locks::TasLock>>();
+    concurrentPushes<BasicLocked<Locks::TicketLock>>();
+    concurrentPushes<BasicLocked<Locks::McsLock>>();
+    concurrentPushes<BasicLocked<Locks::ClhLock>>();
+    concurrentPushes<BasicLocked<Locks::PthreadSpinLock>>();
+}
+
+TEST_F(StagingBufferTest, BasicLockedIgnoresBasicMutex) {
+    StagingBuffers::BasicLocked<Locks::TasLock> locked(0);
+    int bytesAvail;
+
+    // None of the entry points may block on the mutex it inherits
+    StagingBuffers::Lock unused(locked.mutex);
+
+    char *reserved = locked.reserveProducerSpace(4);
+    ASSERT_EQ(locked.buffer, reserved);
+
+    char head[] = "ab", tail[] = "c";
+    struct iovec iov[2] = {{head, 2}, {tail, 2}};
+    EXPECT_TRUE(locked.pushv(iov));
+    EXPECT_TRUE(locked.pushv(iov, 2));
+
+    locked.peek(bytesAvail);
+    EXPECT_EQ(0, bytesAvail);
+
+    std::memcpy(reserved, "xyz", 4);
+    locked.finishReservation(reserved, 4);
+
+    const char *eatMe = locked.peek(bytesAvail);
+    EXPECT_EQ(12, bytesAvail);
+    EXPECT_STREQ("xyz", eatMe);
+    EXPECT_STREQ("abc", eatMe + 4);
+    EXPECT_STREQ("abc", eatMe + 8);
+}
+
+TEST_F(StagingBufferTest, FlatCombiningConcurrentPushes) {
+    concurrentPushes<StagingBuffers::FlatCombining>();
+}
+
+TEST_F(StagingBufferTest, FlatCombiningSlots) {
+    using StagingBuffers::FlatCombining;
+    alignas(FlatCombining) static char storage[sizeof(FlatCombining)];
+    int bytesAvail;
+
+    // Threads beyond the last slot still get their pushes through
+    FlatCombining *fc = new(storage) FlatCombining(0);
+    const int numThreads = NanoLogConfig::FLAT_COMBINING_SLOTS + 4;
+    for (int i = 0; i < numThreads; ++i)
+        std::thread([fc]() { ASSERT_TRUE(fc->push("abc", 4)); }).join();
+
+    EXPECT_EQ(NanoLogConfig::FLAT_COMBINING_SLOTS, fc->numRequests);
+    fc->peek(bytesAvail);
+    EXPECT_EQ(4*numThreads, bytesAvail);
+
+    // A buffer at the same address as one this thread pushed into before
+    // must hand out a fresh slot rather than the stale one
+    EXPECT_TRUE(fc->push("abc", 4));
+    EXPECT_EQ(NanoLogConfig::FLAT_COMBINING_SLOTS, fc->numRequests);
+    fc->~FlatCombining();
+
+    fc = new(storage) FlatCombining(1);
+    EXPECT_TRUE(fc->push("abc", 4));
+    EXPECT_EQ(1, fc->numRequests);
+    fc->~FlatCombining();
+}
+
+TEST_F(StagingBufferTest, StdDequeStartsEmpty) {
+    StagingBuffers::StdDeque<16> deque(0);
+    int bytesAvail;
+    deque.peek(bytesAvail);
+    EXPECT_EQ(0, bytesAvail);
+
+    char record[16] = "123456789012345";
+    ASSERT_TRUE(deque.push(record, sizeof(record)));
+    deque.peek(bytesAvail);
+    EXPECT_EQ(16, bytesAvail);
+}
+
+TEST_F(StagingBufferTest, TwoLockQueueConcurrentPushPop) {
+    // Enough elements to fill the queue and wrap around its node ring
+    using Queue = StagingBuffers::TwoLockQueue<16>;
+    const int numThreads = 4;
+    const int pushesPerThread = Queue::CAPACITY;
+    Queue queue(0);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&queue, i]() {
+            char record[16];
+            std::memset(record, 'a' + i, sizeof(record));
+            for (int j = 0; j < pushesPerThread; ++j)
+                ASSERT_TRUE(queue.push(record, sizeof(record)));
+        });
+    }
+
+    std::vector<int> numPopped(numThreads, 0);
+    for (int n = 0; n < numThreads*pushesPerThread; ++n) {
+        int bytesAvail = 0;
+        while (bytesAvail == 0)
+            queue.peek(bytesAvail);
+        ASSERT_LE(bytesAvail, Queue::CAPACITY*16);
+
+        // The first element is in the node after the dummy
+        const char *data = queue.head->next->array;
+        int producer = data[0] - 'a';
+        ASSERT_TRUE(producer >= 0 && producer < numThreads);
+        for (int j = 1; j < 16; ++j)
+            ASSERT_EQ(data[0], data[j]);
+        ++numPopped[producer];
+
+        ASSERT_TRUE(queue.pop(16));
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    for (int i = 0; i < numThreads; ++i)
+        EXPECT_EQ(pushesPerThread, numPopped[i]);
+
+    int bytesAvail;
+    queue.peek(bytesAvail);
+    EXPECT_EQ(0, bytesAvail);
+}
+
+TEST_F(StagingBufferTest, MpscConcurrentPushesWrapAround) {
+    // Enough variable-sized records to wrap around the buffer several times
+    const int numThreads = 4;
+    const int pushesPerThread = 20000;
+    Alternatives::MpscStagingBuffer mpsc(0);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        threads.emplace_back([&mpsc, i]() {
+            char record[128];
+            for (uint32_t j = 0; j < pushesPerThread; ++j) {
+                uint32_t nbytes = 8 + j % 113;
+                std::memcpy(record, &j, sizeof(j));
+                std::memset(record + sizeof(j), 'a' + i, nbytes - sizeof(j));
+                while (!mpsc.push(record, nbytes));
+            }
+        });
+    }
+
+    // Each producer's records come out whole and in the order pushed
+    std::vector<uint32_t> nextSeq(numThreads, 0);
+    for (int n = 0; n < numThreads*pushesPerThread; ++n) {
+        uint32_t nbytes;
+        const char *data;
+        while ((data = mpsc.front(&nbytes)) == nullptr);
+
+        uint32_t seq;
+        std::memcpy(&seq, data, sizeof(seq));
+        int producer = data[sizeof(seq)] - 'a';
+        ASSERT_TRUE(producer >= 0 && producer < numThreads);
+        ASSERT_EQ(nextSeq[producer]++, seq);
+        ASSERT_EQ(8 + seq % 113, nbytes);
+        for (uint32_t j = sizeof(seq); j < nbytes; ++j)
+            ASSERT_EQ('a' + producer, data[j]);
+
+        mpsc.pop();
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    uint32_t nbytes;
+    EXPECT_EQ(nullptr, mpsc.front(&nbytes));
+}
+
+TEST_F(StagingBufferTest, HybridRegistryReconfigure) {
+    using Registry = Alternatives::HybridStagingBufferRegistry<
+                                            Alternatives::StagingBuffer<64>>;
+    uint64_t bytesDrained = 0;
+    auto process = [&bytesDrained](char *data, uint64_t nbytes) {
+        EXPECT_EQ('x', data[0]);
+        bytesDrained += nbytes;
+        return nbytes;
+    };
+
+    // Only shared buffers, so this thread keeps a pointer to one
+    Registry::configure(0, 0);
+    Registry::push("x", 1);
+    EXPECT_EQ(1U, Registry::drain(process));
+
+    // After the shared buffers are replaced, the thread must push into a
+    // new one rather than the one it was assigned before
+    Registry::configure(0, 0);
+    Registry::push("x", 1);
+    EXPECT_EQ(1U, Registry::drain(process));
+    EXPECT_EQ(2U, bytesDrained);
+}
+
+TEST_F(StagingBufferTest, SequenceSkipRecordAtWrapAround) {
+    using Alternatives::SequenceStagingBuffer;
+    SequenceStagingBuffer sb(0);
+    const uint32_t size = NanoLogConfig::STAGING_BUFFER_SIZE;
+    uint64_t bytesAvail;
+    char *data;
+
+    // The buffer can be filled completely
+    const uint32_t fullBytes = size - sizeof(uint32_t);
+    sb.reserveProducerSpace(fullBytes);
+    sb.finishReservation(fullBytes);
+    sb.peek(&bytesAvail);
+    ASSERT_EQ(size, bytesAvail);
+    sb.consume(bytesAvail);
+
+    // Leave 8 bytes at the end of storage, too few for the next record
+    const uint32_t firstBytes = size - 8 - sizeof(uint32_t);
+    char *pos = sb.reserveProducerSpace(firstBytes);
+    std::memset(pos, 'a', firstBytes);
+    sb.finishReservation(firstBytes);
+
+    sb.peek(&bytesAvail);
+    ASSERT_EQ(size - 8, bytesAvail);
+    sb.consume(bytesAvail);
+
+    pos = sb.reserveProducerSpace(16);
+    std::memset(pos, 'b', 16);
+    sb.finishReservation(16);
+
+    // The skip record covers the rest of the lap...
+    data = sb.peek(&bytesAvail);
+    ASSERT_EQ(8U, bytesAvail);
+    auto *header = reinterpret_cast<SequenceStagingBuffer::RecordHeader*>(
+                                                                    data);
+    EXPECT_EQ(SequenceStagingBuffer::SKIP, header->length);
+    sb.consume(bytesAvail);
+
+    // ...and the record follows at the start of storage
+    data = sb.peek(&bytesAvail);
+    ASSERT_EQ(SequenceStagingBuffer::recordSize(16), bytesAvail);
+    header = reinterpret_cast<SequenceStagingBuffer::RecordHeader*>(data);
+    EXPECT_EQ(16U, header->length);
+    EXPECT_EQ('b', data[sizeof(*header)]);
+    EXPECT_EQ('b', data[sizeof(*header) + 15]);
+    sb.consume(bytesAvail);
+
+    data = sb.peek(&bytesAvail);
+    EXPECT_EQ(0U, bytesAvail);
+}
+
 } // empty namespace
\ No newline at end of file
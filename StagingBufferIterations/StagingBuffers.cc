@@ -21,6 +21,68 @@
 
 namespace StagingBuffers {
 
+/**
+ * Records a newly reserved region as the youngest outstanding one. The
+ * caller must check isFull() first.
+ *
+ * \param pos
+ *      Offset of the region within the buffer
+ */
+void
+Reservations::add(int pos)
+{
+    assert(!isFull());
+
+    int tail = (head + count) % NanoLogConfig::MAX_RESERVATIONS;
+    entries[tail].pos = pos;
+    entries[tail].finished = false;
+    ++count;
+}
+
+/**
+ * Marks an outstanding region as finished and retires every finished
+ * region at the head of the FIFO, which exposes them to the consumer.
+ *
+ * \param pos
+ *      Offset of the region within the buffer
+ */
+void
+Reservations::finish(int pos)
+{
+    int i = 0;
+    while (i < count &&
+            entries[(head + i) % NanoLogConfig::MAX_RESERVATIONS].pos != pos)
+        ++i;
+
+    assert(i < count);
+    entries[(head + i) % NanoLogConfig::MAX_RESERVATIONS].finished = true;
+
+    while (count > 0 && entries[head].finished) {
+        head = (head + 1) % NanoLogConfig::MAX_RESERVATIONS;
+        --count;
+    }
+}
+
+/**
+ * Shortens a region the consumer is about to read so that it stops before
+ * the oldest unfinished reservation.
+ *
+ * \param readPos
+ *      Offset of the region within the buffer
+ * \param[in,out] bytesAvail
+ *      Number of bytes available for reading from readPos
+ */
+void
+Reservations::clamp(int readPos, int &bytesAvail)
+{
+    if (count == 0)
+        return;
+
+    int firstPos = entries[head].pos;
+    if (firstPos >= readPos && firstPos < readPos + bytesAvail)
+        bytesAvail = firstPos - readPos;
+}
+
 /**
  * Copies nbytes of data into the buffer. If successful, it returns true,
  * else false indicates not enough space in the buffer.
@@ -36,6 +98,128 @@ bool Basic::push(const char *data, int nbytes)
 {
     Lock _(mutex);
 
+    char *pos = allocateSpace(nbytes);
+    if (pos == nullptr)
+        return false;
+
+    std::memcpy(pos, data, nbytes);
+    bytesPushed += nbytes;
+    bytesReadable += nbytes;
+    return true;
+}
+
+/**
+ * Gathers an array of fragments into the buffer as a single push, copying
+ * each directly into the space allocated rather than requiring the caller
+ * to assemble them into one contiguous source first.
+ *
+ * \param iov
+ *      Fragments to copy in, in order
+ * \param iovcnt
+ *      Number of fragments in *iov
+ * \return
+ *      true is success; false means insufficient space
+ */
+bool Basic::pushv(const struct iovec *iov, int iovcnt)
+{
+    int nbytes = iovLength(iov, iovcnt);
+    Lock _(mutex);
+
+    char *pos = allocateSpace(nbytes);
+    if (pos == nullptr)
+        return false;
+
+    gather(pos, iov, iovcnt);
+    bytesPushed += nbytes;
+    bytesReadable += nbytes;
+    return true;
+}
+
+/**
+ * Reserves nbytes of contiguous space for the producer to fill in outside
+ * of the lock. The space is not visible to the consumer until it's
+ * finishReservation()-ed, and neither is anything push()-ed or reserved
+ * after it. Multiple reservations may be outstanding at once.
+ *
+ * \param nbytes
+ *      Number of bytes to reserve
+ * \return
+ *      Pointer to the reserved space; nullptr means insufficient space
+ */
+char *
+Basic::reserveProducerSpace(int nbytes)
+{
+    Lock _(mutex);
+    return reserveInternal(nbytes);
+}
+
+/**
+ * Body of reserveProducerSpace(); must be invoked with the lock held.
+ *
+ * \param nbytes
+ *      Number of bytes to reserve
+ * \return
+ *      Pointer to the reserved space; nullptr means insufficient space
+ */
+char *
+Basic::reserveInternal(int nbytes)
+{
+    if (reservations.isFull())
+        return nullptr;
+
+    char *pos = allocateSpace(nbytes);
+    if (pos != nullptr)
+        reservations.add(pos - buffer);
+
+    return pos;
+}
+
+/**
+ * Complement to reserveProducerSpace() that marks a reservation as filled
+ * in. The reserved data becomes visible to the consumer once all the
+ * reservations made before it have been finished too.
+ *
+ * \param pos
+ *      Pointer returned by reserveProducerSpace()
+ * \param nbytes
+ *      Number of bytes that were passed to reserveProducerSpace()
+ */
+void
+Basic::finishReservation(const char *pos, int nbytes)
+{
+    Lock _(mutex);
+    finishReservationInternal(pos, nbytes);
+}
+
+/**
+ * Body of finishReservation(); must be invoked with the lock held.
+ *
+ * \param pos
+ *      Pointer returned by reserveProducerSpace()
+ * \param nbytes
+ *      Number of bytes that were passed to reserveProducerSpace()
+ */
+void
+Basic::finishReservationInternal(const char *pos, int nbytes)
+{
+    reservations.finish(static_cast<int>(pos - buffer));
+    bytesPushed += nbytes;
+    bytesReadable += nbytes;
+}
+
+/**
+ * Advances writePos past nbytes of contiguous space and returns the start
+ * of it, rolling over to the beginning of the buffer if necessary. Must be
+ * invoked with the lock held.
+ *
+ * \param nbytes
+ *      Number of bytes to allocate
+ * \return
+ *      Pointer to the allocated space; nullptr means insufficient space
+ */
+char *
+Basic::allocateSpace(int nbytes)
+{
     // TRICK: When pushing data, we need to ensure that the positions will
     // NOT overlap after the push as this would indicate 0 readable data.
     // Thus all space checks are performed with <= checks to ensure that
@@ -43,7 +227,7 @@ bool Basic::push(const char *data, int nbytes)
 
     // Check for space when reader is in front of the writer (us)
     if (readPos > writePos && readPos - writePos <= nbytes)
-        return false;
+        return nullptr;
 
     // If the reader is behind us, check to see if we need to roll over
     if (readPos <= writePos
@@ -52,18 +236,29 @@ bool Basic::push(const char *data, int nbytes)
         endOfWrittenSpace = writePos;
 
         if (readPos == 0)
-            return false;
+            return nullptr;
 
         writePos = 0;
         if (readPos <= nbytes)
-            return false;
+            return nullptr;
     }
 
-    std::memcpy(&buffer[writePos], data, nbytes);
-    bytesPushed += nbytes;
-    bytesReadable += nbytes;
+    char *pos = &buffer[writePos];
     writePos += nbytes;
-    return true;
+    return pos;
+}
+
+/**
+ * Shortens a peek()-ed region starting at readPos so that it stops before
+ * the first outstanding reservation. Must be invoked with the lock held.
+ *
+ * \param[in,out] bytesAvail
+ *      Number of bytes available for reading from readPos
+ */
+void
+Basic::clampToReservations(int &bytesAvail)
+{
+    reservations.clamp(readPos, bytesAvail);
 }
 
 /**
@@ -79,7 +274,20 @@ const char*
 Basic::peek(int &bytesAvail)
 {
     Lock _(mutex);
+    return peekInternal(bytesAvail);
+}
 
+/**
+ * Body of peek(); must be invoked with the lock held.
+ *
+ * \param[out] bytesAvail
+ *      Number of bytes available  for reading
+ * \return
+ *      Pointer to read from
+ */
+const char*
+Basic::peekInternal(int &bytesAvail)
+{
     if (readPos <= writePos) {
         bytesAvail = writePos - readPos;
     } else {
@@ -92,6 +300,7 @@ Basic::peek(int &bytesAvail)
         }
     }
 
+    clampToReservations(bytesAvail);
     return &buffer[readPos];
 }
 
@@ -105,6 +314,17 @@ Basic::peek(int &bytesAvail)
 void Basic::pop(int nbytes)
 {
     Lock _(mutex);
+    popInternal(nbytes);
+}
+
+/**
+ * Body of pop(); must be invoked with the lock held.
+ *
+ * \param nbytes
+ *      Number of bytes to free up
+ */
+void Basic::popInternal(int nbytes)
+{
     assert(bytesReadable >= nbytes);
 
     bytesReadable -= nbytes;
@@ -144,42 +364,169 @@ BasicSpinLock::push(const char *data, int nbytes)
         PerfUtils::Cycles::rdtsc();
     };  // spin acquire lock with a small (~8ns) backoff
 
-    // TRICK: When pushing data, we need to ensure that the positions will
-    // NOT overlap after the push as this would indicate 0 readable data.
-    // Thus all space checks are performed with <= checks to ensure that
-    // the pointers will not overlap after a push.
+    char *pos = allocateSpace(nbytes);
+    if (pos == nullptr) {
+        lock.clear(std::memory_order_release);
+        return false;
+    }
 
-    // Check for space when reader is in front of the writer (us)
-    if (readPos > writePos && readPos - writePos <= nbytes) {
+    std::memcpy(pos, data, nbytes);
+    bytesPushed += nbytes;
+    bytesReadable += nbytes;
+
+    lock.clear(std::memory_order_release);
+    return true;
+}
+
+/**
+ * Gathers an array of fragments into the buffer as a single push. See
+ * Basic::pushv() for details.
+ *
+ * \param iov
+ *      Fragments to copy in, in order
+ * \param iovcnt
+ *      Number of fragments in *iov
+ * \return
+ *      true is success; false means insufficient space
+ */
+bool
+BasicSpinLock::pushv(const struct iovec *iov, int iovcnt)
+{
+    int nbytes = iovLength(iov, iovcnt);
+    while (lock.test_and_set(std::memory_order_acquire)) {
+        PerfUtils::Cycles::rdtsc();
+    };  // spin acquire lock with a small (~8ns) backoff
+
+    char *pos = allocateSpace(nbytes);
+    if (pos == nullptr) {
         lock.clear(std::memory_order_release);
         return false;
     }
 
+    gather(pos, iov, iovcnt);
+    bytesPushed += nbytes;
+    bytesReadable += nbytes;
+
+    lock.clear(std::memory_order_release);
+    return true;
+}
+
+/**
+ * Reserves nbytes of contiguous space for the producer to fill in outside
+ * of the lock. See Basic::reserveProducerSpace() for details.
+ *
+ * \param nbytes
+ *      Number of bytes to reserve
+ * \return
+ *      Pointer to the reserved space; nullptr means insufficient space
+ */
+char *
+BasicSpinLock::reserveProducerSpace(int nbytes)
+{
+    while (lock.test_and_set(std::memory_order_acquire)) {
+        PerfUtils::Cycles::rdtsc();
+    };  // spin acquire lock with a small (~8ns) backoff
+
+    char *pos = reserveInternal(nbytes);
+
+    lock.clear(std::memory_order_release);
+    return pos;
+}
+
+/**
+ * Complement to reserveProducerSpace() that marks a reservation as filled
+ * in. See Basic::finishReservation() for details.
+ *
+ * \param pos
+ *      Pointer returned by reserveProducerSpace()
+ * \param nbytes
+ *      Number of bytes that were passed to reserveProducerSpace()
+ */
+void
+BasicSpinLock::finishReservation(const char *pos, int nbytes)
+{
+    while (lock.test_and_set(std::memory_order_acquire)) {
+        PerfUtils::Cycles::rdtsc();
+    };  // spin acquire lock with a small (~8ns) backoff
+
+    finishReservationInternal(pos, nbytes);
+
+    lock.clear(std::memory_order_release);
+}
+
+/**
+ * See Basic::reserveInternal()
+ */
+char *
+BasicSpinLock::reserveInternal(int nbytes)
+{
+    if (reservations.isFull())
+        return nullptr;
+
+    char *pos = allocateSpace(nbytes);
+    if (pos != nullptr)
+        reservations.add(pos - buffer);
+
+    return pos;
+}
+
+/**
+ * See Basic::finishReservationInternal()
+ */
+void
+BasicSpinLock::finishReservationInternal(const char *pos, int nbytes)
+{
+    reservations.finish(static_cast<int>(pos - buffer));
+    bytesPushed += nbytes;
+    bytesReadable += nbytes;
+}
+
+/**
+ * Advances writePos past nbytes of contiguous space and returns the start
+ * of it. See Basic::allocateSpace() for details.
+ *
+ * \param nbytes
+ *      Number of bytes to allocate
+ * \return
+ *      Pointer to the allocated space; nullptr means insufficient space
+ */
+char *
+BasicSpinLock::allocateSpace(int nbytes)
+{
+    // Check for space when reader is in front of the writer (us)
+    if (readPos > writePos && readPos - writePos <= nbytes)
+        return nullptr;
+
     // If the reader is behind us, check to see if we need to roll over
     if (readPos <= writePos
             && NanoLogConfig::STAGING_BUFFER_SIZE - writePos < nbytes)
     {
         endOfWrittenSpace = writePos;
 
-        if (readPos == 0) {
-            lock.clear(std::memory_order_release);
-            return false;
-        }
+        if (readPos == 0)
+            return nullptr;
 
         writePos = 0;
-        if (readPos <= nbytes) {
-            lock.clear(std::memory_order_release);
-            return false;
-        }
+        if (readPos <= nbytes)
+            return nullptr;
     }
 
-    std::memcpy(&buffer[writePos], data, nbytes);
-    bytesPushed += nbytes;
-    bytesReadable += nbytes;
+    char *pos = &buffer[writePos];
     writePos += nbytes;
+    return pos;
+}
 
-    lock.clear(std::memory_order_release);
-    return true;
+/**
+ * Shortens a peek()-ed region so that it stops before the first
+ * outstanding reservation. Must be invoked with the lock held.
+ *
+ * \param[in,out] bytesAvail
+ *      Number of bytes available for reading from readPos
+ */
+void
+BasicSpinLock::clampToReservations(int &bytesAvail)
+{
+    reservations.clamp(readPos, bytesAvail);
 }
 
 /**
@@ -208,6 +555,7 @@ BasicSpinLock::peek(int &bytesAvail)
         }
     }
 
+    clampToReservations(bytesAvail);
     char *ret = &buffer[readPos];
     lock.clear(std::memory_order_release);
     return ret;
@@ -261,42 +609,96 @@ bool
 SignalPoll::push(const char *data, int nbytes) {
     Lock _(mutex);
 
+    waitForSpace(_, nbytes);
+    producedSome.notify_one();
+    ++numNotifies;
+
+    std::memcpy(&buffer[writePos], data, nbytes);
+    bytesPushed += nbytes;
+    bytesReadable += nbytes;
+    writePos += nbytes;
+    return true;
+}
+
+/**
+ * Gathers an array of fragments into the buffer as a single push. If there
+ * is not enough space, this function will block until enough is freed.
+ *
+ * \param iov
+ *      Fragments to copy in, in order
+ * \param iovcnt
+ *      Number of fragments in *iov
+ * \return
+ *      true is success; false indicates error
+ */
+bool
+SignalPoll::pushv(const struct iovec *iov, int iovcnt) {
+    int nbytes = iovLength(iov, iovcnt);
+    Lock _(mutex);
+
+    waitForSpace(_, nbytes);
+    producedSome.notify_one();
+    ++numNotifies;
+
+    gather(&buffer[writePos], iov, iovcnt);
+    bytesPushed += nbytes;
+    bytesReadable += nbytes;
+    writePos += nbytes;
+    return true;
+}
+
+/**
+ * Blocks until there are nbytes of contiguous space at writePos, rolling
+ * over to the beginning of the buffer if necessary. Note this is an
+ * internal function that must be called with a lock.
+ *
+ * \param lock
+ *      Monitor lock grabbed for this object
+ * \param nbytes
+ *      Number of bytes the caller intends to push
+ */
+void
+SignalPoll::waitForSpace(Lock &lock, int nbytes) {
+    while (!hasSpaceFor(nbytes))
+        consumedSome.wait(lock);
+}
+
+/**
+ * Checks whether there are nbytes of contiguous space at writePos, rolling
+ * over to the beginning of the buffer if necessary. Note this is an
+ * internal function that must be called with a lock.
+ *
+ * \param nbytes
+ *      Number of bytes the caller intends to push
+ * \return
+ *      true if there's space; false means the caller must wait
+ */
+bool
+SignalPoll::hasSpaceFor(int nbytes) {
     // TRICK: When pushing data, we need to ensure that the positions will
     // NOT overlap after the push as this would indicate 0 readable data.
     // Thus all space checks are performed with <= checks to ensure that
     // the pointers will not overlap after a push.
 
-    while (true) {
-        bool hasSpace = true;
-
-        // Check for space when reader is in front of the writer (us)
-        if (readPos > writePos && readPos - writePos <= nbytes) {
-            hasSpace = false;
-        } else if (readPos <= writePos &&
-                    NanoLogConfig::STAGING_BUFFER_SIZE - writePos < nbytes)
-        {
-            // If the reader is behind us, check to see if we need to roll over
-            endOfWrittenSpace = writePos;
-
-            if (readPos == 0)
-                hasSpace = false;
-
-            writePos = 0;
-            if (readPos <= nbytes)
-                hasSpace = false;
-        }
+    // Check for space when reader is in front of the writer (us)
+    if (readPos > writePos && readPos - writePos <= nbytes)
+        return false;
 
-        if (hasSpace)
-            break;
+    if (readPos <= writePos &&
+            NanoLogConfig::STAGING_BUFFER_SIZE - writePos < nbytes)
+    {
+        // If the reader is behind us, we need to roll over. We can't while
+        // the reader is at the beginning though, since writePos == readPos
+        // would make the full buffer look empty.
+        if (readPos == 0)
+            return false;
 
-        consumedSome.wait(_);
+        endOfWrittenSpace = writePos;
+        writePos = 0;
+        if (readPos <= nbytes)
+            return false;
     }
-    producedSome.notify_one();
 
-    std::memcpy(&buffer[writePos], data, nbytes);
-    bytesPushed += nbytes;
-    bytesReadable += nbytes;
-    writePos += nbytes;
     return true;
 }
 
@@ -356,6 +758,7 @@ SignalPoll::pop(int nbytes) {
     if (readPos < writePos) {
         readPos += nbytes;
         consumedSome.notify_all();
+        ++numNotifies;
         return;
     }
 
@@ -370,6 +773,302 @@ SignalPoll::pop(int nbytes) {
     }
 
     consumedSome.notify_all();
+    ++numNotifies;
+}
+
+/**
+ * Copies nbytes of data into the buffer. If there is not enough space, this
+ * function will block until enough space is freed for the *data
+ *
+ * \param data
+ *      Pointer to the data to copy in
+ * \param nbytes
+ *      Number of bytes to copy from *data
+ * \return
+ *      true is success; false indicates error
+ */
+bool
+SignalOnTransition::push(const char *data, int nbytes) {
+    Lock _(mutex);
+
+    waitForSpace(_, nbytes);
+    std::memcpy(&buffer[writePos], data, nbytes);
+    bool notify = finishPush(nbytes);
+    _.unlock();
+
+    if (notify)
+        producedSome.notify_all();
+
+    return true;
+}
+
+/**
+ * Gathers an array of fragments into the buffer as a single push. If there
+ * is not enough space, this function will block until enough is freed.
+ *
+ * \param iov
+ *      Fragments to copy in, in order
+ * \param iovcnt
+ *      Number of fragments in *iov
+ * \return
+ *      true is success; false indicates error
+ */
+bool
+SignalOnTransition::pushv(const struct iovec *iov, int iovcnt) {
+    int nbytes = iovLength(iov, iovcnt);
+    Lock _(mutex);
+
+    waitForSpace(_, nbytes);
+    gather(&buffer[writePos], iov, iovcnt);
+    bool notify = finishPush(nbytes);
+    _.unlock();
+
+    if (notify)
+        producedSome.notify_all();
+
+    return true;
+}
+
+/**
+ * Blocks until there are nbytes of contiguous space at writePos, counting
+ * the caller among the producersWaiting while it waits. Note this is an
+ * internal function that must be called with a lock.
+ *
+ * \param lock
+ *      Monitor lock grabbed for this object
+ * \param nbytes
+ *      Number of bytes the caller intends to push
+ */
+void
+SignalOnTransition::waitForSpace(Lock &lock, int nbytes) {
+    while (!hasSpaceFor(nbytes)) {
+        ++producersWaiting;
+        consumedSome.wait(lock);
+    }
+}
+
+/**
+ * Publishes nbytes just copied in at writePos. Note this is an internal
+ * function that must be called with a lock.
+ *
+ * \param nbytes
+ *      Number of bytes copied in
+ * \return
+ *      true if the caller must notify producedSome once it drops the lock
+ */
+bool
+SignalOnTransition::finishPush(int nbytes) {
+    bytesPushed += nbytes;
+    bytesReadable += nbytes;
+    writePos += nbytes;
+
+    if (consumersWaiting == 0)
+        return false;
+
+    consumersWaiting = 0;
+    ++numNotifies;
+    return true;
+}
+
+/**
+ * Frees up nbytes for production in the StagingBuffer. If there's not enough
+ * space to free in the StagingBuffer, this function will block until there is.
+ *
+ * \param nbytes
+ *      Number of bytes to free up
+ */
+void
+SignalOnTransition::pop(int nbytes) {
+    Lock _(mutex);
+
+    while (true) {
+        int bytesAvail = 0;
+        peek(_, bytesAvail);
+
+        if (bytesAvail >= nbytes)
+            break;
+
+        ++consumersWaiting;
+        producedSome.wait(_);
+    }
+
+    bytesReadable -= nbytes;
+    bytesPopped += nbytes;
+
+    if (readPos < writePos) {
+        readPos += nbytes;
+    } else {
+        int firstHalf = endOfWrittenSpace - readPos;
+        if (firstHalf >= nbytes) {
+            readPos += nbytes;
+        } else if (firstHalf == 0) {
+            readPos = 0;
+        } else {
+            nbytes -= firstHalf;
+            readPos = nbytes;
+        }
+    }
+
+    bool notify = (producersWaiting > 0);
+    if (notify) {
+        producersWaiting = 0;
+        ++numNotifies;
+    }
+    _.unlock();
+
+    if (notify)
+        consumedSome.notify_all();
+}
+
+std::atomic<uint64_t> FlatCombining::numGenerations(0);
+
+/**
+ * Posts a push() request in the calling thread's slot and waits for it to
+ * be performed, either by another producer that holds the lock or by
+ * acquiring the lock and performing all the posted requests itself. If
+ * all the slots are taken, it performs the push under the lock instead.
+ *
+ * \param data
+ *      Pointer to the data to copy in
+ * \param nbytes
+ *      Number of bytes to copy from *data
+ * \return
+ *      true is success; false means insufficient space
+ */
+bool
+FlatCombining::push(const char *data, int nbytes)
+{
+    Request *request = getRequest();
+    if (request == nullptr) {
+        std::lock_guard<Locks::TasLock> _(lock);
+
+        char *pos = allocateSpace(nbytes);
+        if (pos == nullptr)
+            return false;
+
+        std::memcpy(pos, data, nbytes);
+        bytesPushed += nbytes;
+        bytesReadable += nbytes;
+        return true;
+    }
+
+    request->data = data;
+    request->nbytes = nbytes;
+    request->status.store(PENDING, std::memory_order_release);
+
+    int status;
+    while ((status = request->status.load(std::memory_order_acquire))
+                                                            == PENDING) {
+        // Only go for the lock when it looks free, so waiting producers
+        // spin on their own slots rather than on the lock's cache line
+        if (!lock.isLocked() && lock.try_lock()) {
+            combine();
+            lock.unlock();
+        } else {
+            _mm_pause();
+        }
+    }
+
+    request->status.store(IDLE, std::memory_order_relaxed);
+    return status == PUSHED;
+}
+
+/**
+ * Returns the calling thread's request slot, assigning it one on its
+ * first push(). Slots are held for the lifetime of the buffer.
+ *
+ * \return
+ *      The calling thread's slot; nullptr means all the slots were taken
+ *      by other threads
+ */
+FlatCombining::Request *
+FlatCombining::getRequest()
+{
+    // Slot assigned to the calling thread and the generation of the buffer
+    // it belongs to; -1 means the buffer had no slots left
+    static thread_local uint64_t owner = 0;
+    static thread_local int slot = -1;
+
+    if (owner != generation) {
+        slot = numRequests.load(std::memory_order_relaxed);
+        do {
+            if (slot >= NanoLogConfig::FLAT_COMBINING_SLOTS) {
+                slot = -1;
+                break;
+            }
+        } while (!numRequests.compare_exchange_weak(slot, slot + 1,
+                                                std::memory_order_relaxed));
+        owner = generation;
+    }
+
+    return (slot < 0) ? nullptr : &requests[slot];
+}
+
+/**
+ * Performs all the posted push() requests. Space for all of them is
+ * allocated at once if it's available contiguously; otherwise they're
+ * allocated one by one as a regular push() would. Must be invoked with
+ * the lock held.
+ */
+void
+FlatCombining::combine()
+{
+    int numAssigned = numRequests.load(std::memory_order_acquire);
+    Request *pending[NanoLogConfig::FLAT_COMBINING_SLOTS];
+    int numPending = 0;
+    int totalBytes = 0;
+
+    for (int i = 0; i < numAssigned; ++i) {
+        if (requests[i].status.load(std::memory_order_acquire) == PENDING) {
+            pending[numPending++] = &requests[i];
+            totalBytes += requests[i].nbytes;
+        }
+    }
+
+    if (numPending == 0)
+        return;
+
+    ++numCombines;
+    numCombined += numPending;
+
+    char *pos = allocateSpace(totalBytes);
+    for (int i = 0; i < numPending; ++i) {
+        Request *request = pending[i];
+        char *dst = (pos != nullptr) ? pos : allocateSpace(request->nbytes);
+
+        if (dst == nullptr) {
+            request->status.store(FULL, std::memory_order_release);
+            continue;
+        }
+
+        std::memcpy(dst, request->data, request->nbytes);
+        if (pos != nullptr)
+            pos += request->nbytes;
+
+        bytesPushed += request->nbytes;
+        bytesReadable += request->nbytes;
+        request->status.store(PUSHED, std::memory_order_release);
+    }
+}
+
+/**
+ * See Basic::peek()
+ */
+const char*
+FlatCombining::peek(int &bytesAvail)
+{
+    std::lock_guard<Locks::TasLock> _(lock);
+    return peekInternal(bytesAvail);
+}
+
+/**
+ * See Basic::pop()
+ */
+void
+FlatCombining::pop(int nbytes)
+{
+    std::lock_guard<Locks::TasLock> _(lock);
+    popInternal(nbytes);
 }
 
 }; // StagingBuffers namespace
\ No newline at end of file
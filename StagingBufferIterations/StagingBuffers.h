@@ -16,7 +16,10 @@
 #ifndef _STAGINGBUFFERS_H_
 #define _STAGINGBUFFERS_H_
 
+#include <cassert>
 #include <cstdint>
+#include <cstring>
+#include <sys/uio.h>
 
 #include <atomic>
 #include <condition_variable>
@@ -24,6 +27,8 @@
 #include <mutex>
 
 #include "Config.h"
+#include "Locks.h"
+#include "PerfUtils/Cycles.h"
 
 /**
  * This file contains various NanoLog StagingBuffer implementations that have
@@ -33,6 +38,83 @@
 namespace StagingBuffers {
     using Lock = std::unique_lock<std::mutex>;
 
+    /**
+     * Returns the total number of bytes described by an array of fragments
+     * passed to pushv().
+     */
+    static inline int
+    iovLength(const struct iovec *iov, int iovcnt) {
+        size_t nbytes = 0;
+        for (int i = 0; i < iovcnt; ++i)
+            nbytes += iov[i].iov_len;
+
+        return static_cast<int>(nbytes);
+    }
+
+    /**
+     * Copies the fragments of a pushv() back-to-back into dst, which must
+     * have at least iovLength() bytes of space.
+     */
+    static inline void
+    gather(char *dst, const struct iovec *iov, int iovcnt) {
+        for (int i = 0; i < iovcnt; ++i) {
+            std::memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+            dst += iov[i].iov_len;
+        }
+    }
+
+    // Fast paths of the above for a fragment count known at compile time,
+    // which lets the compiler unroll the loops.
+    template<size_t N>
+    static inline int
+    iovLength(const struct iovec (&iov)[N]) {
+        return iovLength(iov, N);
+    }
+
+    template<size_t N>
+    static inline void
+    gather(char *dst, const struct iovec (&iov)[N]) {
+        gather(dst, iov, N);
+    }
+
+    /**
+     * FIFO of the reserveProducerSpace() regions of a locked buffer that
+     * have yet to be made visible, in the order they were allocated. The
+     * producers sharing the buffer may finish them in any order; the
+     * consumer may read up to the oldest one that's still being filled in.
+     * Must be accessed with the buffer's lock held.
+     */
+    struct Reservations {
+        struct Entry {
+            // Offset of the region within the buffer
+            int pos;
+
+            // True once the region has been finishReservation()-ed
+            bool finished;
+        };
+
+        // Circular array of the outstanding regions, oldest at head
+        Entry entries[NanoLogConfig::MAX_RESERVATIONS];
+        int head;
+        int count;
+
+        Reservations()
+            : entries()
+            , head(0)
+            , count(0)
+        {
+        }
+
+        bool
+        isFull() {
+            return count == NanoLogConfig::MAX_RESERVATIONS;
+        }
+
+        void add(int pos);
+        void finish(int pos);
+        void clamp(int readPos, int &bytesAvail);
+    };
+
     /**
      * Circular Byte buffer that uses monitor style locking
      */
@@ -56,6 +138,11 @@ namespace StagingBuffers {
         // in buffer is when a roll-over occurs
         int endOfWrittenSpace;
 
+        // reserveProducerSpace() regions that may still be being filled in
+        // outside the lock; the consumer may not peek() past the oldest
+        // unfinished one.
+        Reservations reservations;
+
         // Metrics: Number of bytes push()-ed and pop()-ed
         long bytesPushed;
         long bytesPopped;
@@ -70,6 +157,7 @@ namespace StagingBuffers {
             , writePos(0)
             , bytesReadable(0)
             , endOfWrittenSpace(0)
+            , reservations()
             , bytesPushed(0)
             , bytesPopped(0)
         {
@@ -78,8 +166,205 @@ namespace StagingBuffers {
 
         // true means enqueue was successful
         bool push(const char *data, int nbytes);
+        bool pushv(const struct iovec *iov, int iovcnt);
         const char* peek(int &bytesAvail);
         void pop(int nbytes);
+
+        /**
+         * Gathers N fragments into the buffer as a single push. This is
+         * the fast path of pushv() for a fragment count known at compile
+         * time.
+         *
+         * \param iov
+         *      Fragments to copy in, in order
+         * \return
+         *      true is success; false means insufficient space
+         */
+        template<size_t N>
+        bool pushv(const struct iovec (&iov)[N]) {
+            int nbytes = iovLength(iov);
+            Lock _(mutex);
+
+            char *pos = allocateSpace(nbytes);
+            if (pos == nullptr)
+                return false;
+
+            gather(pos, iov);
+            bytesPushed += nbytes;
+            bytesReadable += nbytes;
+            return true;
+        }
+
+        // nullptr means there was not enough space
+        char *reserveProducerSpace(int nbytes);
+        void finishReservation(const char *pos, int nbytes);
+
+        // Internal; must be invoked with the lock held
+        char *allocateSpace(int nbytes);
+        char *reserveInternal(int nbytes);
+        void finishReservationInternal(const char *pos, int nbytes);
+        void clampToReservations(int &bytesAvail);
+        const char* peekInternal(int &bytesAvail);
+        void popInternal(int nbytes);
+    };
+
+    /**
+     * Basic with the monitor-style mutex replaced by a LockPolicy (see
+     * Locks.h), to compare locks for the buffer shared by all producers.
+     *
+     * \tparam LockPolicy
+     *      BasicLockable type guarding the buffer
+     */
+    template<typename LockPolicy>
+    struct BasicLocked : Basic {
+        // Replaces Basic::mutex, which goes unused: every entry point of
+        // Basic is redefined below to take this lock instead
+        LockPolicy lock;
+
+        BasicLocked(int id)
+            : Basic(id)
+            , lock()
+        {
+        }
+
+        bool push(const char *data, int nbytes) {
+            std::lock_guard<LockPolicy> _(lock);
+
+            char *pos = allocateSpace(nbytes);
+            if (pos == nullptr)
+                return false;
+
+            std::memcpy(pos, data, nbytes);
+            bytesPushed += nbytes;
+            bytesReadable += nbytes;
+            return true;
+        }
+
+        bool pushv(const struct iovec *iov, int iovcnt) {
+            int nbytes = iovLength(iov, iovcnt);
+            std::lock_guard<LockPolicy> _(lock);
+
+            char *pos = allocateSpace(nbytes);
+            if (pos == nullptr)
+                return false;
+
+            gather(pos, iov, iovcnt);
+            bytesPushed += nbytes;
+            bytesReadable += nbytes;
+            return true;
+        }
+
+        template<size_t N>
+        bool pushv(const struct iovec (&iov)[N]) {
+            int nbytes = iovLength(iov);
+            std::lock_guard<LockPolicy> _(lock);
+
+            char *pos = allocateSpace(nbytes);
+            if (pos == nullptr)
+                return false;
+
+            gather(pos, iov);
+            bytesPushed += nbytes;
+            bytesReadable += nbytes;
+            return true;
+        }
+
+        char *reserveProducerSpace(int nbytes) {
+            std::lock_guard<LockPolicy> _(lock);
+            return reserveInternal(nbytes);
+        }
+
+        void finishReservation(const char *pos, int nbytes) {
+            std::lock_guard<LockPolicy> _(lock);
+            finishReservationInternal(pos, nbytes);
+        }
+
+        const char* peek(int &bytesAvail) {
+            std::lock_guard<LockPolicy> _(lock);
+            return peekInternal(bytesAvail);
+        }
+
+        void pop(int nbytes) {
+            std::lock_guard<LockPolicy> _(lock);
+            popInternal(nbytes);
+        }
+    };
+
+    /**
+     * Basic shared by all producers with flat combining: instead of every
+     * producer taking the lock to perform its own push(), producers post
+     * their requests in per-thread slots, and whichever producer gets the
+     * lock performs all the posted pushes in one pass, allocating space for
+     * them with a single update of writePos. The other producers wait on
+     * their own slots rather than on the lock. Producers beyond the first
+     * FLAT_COMBINING_SLOTS get no slot and push() under the lock directly.
+     */
+    struct FlatCombining : Basic {
+        // Result of a posted push
+        enum Status : int { IDLE, PENDING, PUSHED, FULL };
+
+        // A producer's posted push(), on its own cache line
+        struct alignas(NanoLogConfig::BYTES_PER_CACHE_LINE) Request {
+            const char *data;
+            int nbytes;
+            std::atomic<int> status;
+
+            Request()
+                : data(nullptr)
+                , nbytes(0)
+                , status(IDLE)
+            {
+            }
+        };
+
+        // Lock held by the combiner and the consumer; replaces Basic::mutex
+        Locks::TasLock lock;
+
+        // Unique among all the FlatCombining buffers ever constructed, so
+        // that a producer's cached slot can't outlive its buffer and be
+        // reused for a new buffer allocated at the same address
+        uint64_t generation;
+
+        // Source of the generations above
+        static std::atomic<uint64_t> numGenerations;
+
+        // Number of entries of requests assigned to producer threads
+        std::atomic<int> numRequests;
+
+        // Requests posted by the producers, indexed by slot
+        Request requests[NanoLogConfig::FLAT_COMBINING_SLOTS];
+
+        // Metrics: Number of combining passes and pushes performed by them
+        long numCombines;
+        long numCombined;
+
+        FlatCombining(int id)
+            : Basic(id)
+            , lock()
+            , generation(numGenerations.fetch_add(1) + 1)
+            , numRequests(0)
+            , requests()
+            , numCombines(0)
+            , numCombined(0)
+        {
+        }
+
+        // true means enqueue was successful
+        bool push(const char *data, int nbytes);
+        const char* peek(int &bytesAvail);
+        void pop(int nbytes);
+
+        // Only push() is combined; Basic's other ways to produce would
+        // take Basic::mutex instead of the lock
+        bool pushv(const struct iovec *iov, int iovcnt) = delete;
+        template<size_t N>
+        bool pushv(const struct iovec (&iov)[N]) = delete;
+        char *reserveProducerSpace(int nbytes) = delete;
+        void finishReservation(const char *pos, int nbytes) = delete;
+
+        // Internal
+        Request *getRequest();
+        void combine();
     };
 
     template<int bytesPerLog>
@@ -100,7 +385,6 @@ namespace StagingBuffers {
             , consumedSome()
             , producedSome()
         {
-            deque.resize(NanoLogConfig::STAGING_BUFFER_SIZE/bytesPerLog);
         }
 
         bool push(const char *data, int datalen) {
@@ -118,6 +402,38 @@ namespace StagingBuffers {
             return true;
         }
 
+        // Gathers the fragments into a single Element; they may not add
+        // up to more than bytesPerLog.
+        bool pushv(const struct iovec *iov, int iovcnt) {
+            assert(iovLength(iov, iovcnt) <= bytesPerLog);
+
+            Element e;
+            gather(e.array, iov, iovcnt);
+            return pushElement(e);
+        }
+
+        template<size_t N>
+        bool pushv(const struct iovec (&iov)[N]) {
+            assert(iovLength(iov) <= bytesPerLog);
+
+            Element e;
+            gather(e.array, iov);
+            return pushElement(e);
+        }
+
+        bool pushElement(const Element &e) {
+            Lock _(mutex);
+
+            while (deque.size() >= NanoLogConfig::STAGING_BUFFER_SIZE/bytesPerLog) {
+                consumedSome.wait(_);
+            }
+
+            deque.push_back(e);
+            producedSome.notify_one();
+
+            return true;
+        }
+
         void peek(int &bytesAvail) {
             Lock _(mutex);
             bytesAvail = deque.size() * bytesPerLog;
@@ -141,6 +457,152 @@ namespace StagingBuffers {
         std::deque<Element> deque;
     };
 
+    /**
+     * Bounded blocking queue of fixed-size elements in the style of the
+     * Michael & Scott two-lock queue. Producers serialize on tailMutex and
+     * consumers on headMutex, so a push() and a pop() only contend when one
+     * wakes the other (see below). The consumer's end of the list is a
+     * dummy node whose successor holds the first element, so the two sides
+     * never touch the same node while the queue is non-empty.
+     *
+     * The nodes are preallocated and linked into a ring, one more than the
+     * capacity, so push() never allocates: the producer fills the node
+     * after the tail and the consumer turns the node it dequeues into the
+     * new dummy. The element count is the only variable both sides write;
+     * a side only takes the other's lock to wake it up, when the count
+     * leaves zero or the capacity.
+     */
+    template<int bytesPerLog>
+    struct TwoLockQueue {
+        struct Node {
+            char array[bytesPerLog];
+            Node *next;
+        };
+
+        // Number of elements the queue holds when full
+        static const int CAPACITY =
+                                NanoLogConfig::STAGING_BUFFER_SIZE/bytesPerLog;
+
+        // Consumer side: the dummy node and the lock serializing pop()s
+        std::mutex headMutex;
+        std::condition_variable producedSome;
+        Node *head;
+
+        // Producer side: the last node and the lock serializing push()es
+        alignas(NanoLogConfig::BYTES_PER_CACHE_LINE)
+        std::mutex tailMutex;
+        std::condition_variable consumedSome;
+        Node *tail;
+
+        // Number of elements in the queue
+        alignas(NanoLogConfig::BYTES_PER_CACHE_LINE)
+        std::atomic<int> count;
+
+        int id;
+        Node *nodes;
+
+        TwoLockQueue(int id)
+            : headMutex()
+            , producedSome()
+            , head(nullptr)
+            , tailMutex()
+            , consumedSome()
+            , tail(nullptr)
+            , count(0)
+            , id(id)
+            , nodes(new Node[CAPACITY + 1])
+        {
+            for (int i = 0; i < CAPACITY; ++i)
+                nodes[i].next = &nodes[i + 1];
+            nodes[CAPACITY].next = &nodes[0];
+
+            head = tail = &nodes[0];
+        }
+
+        ~TwoLockQueue() {
+            delete[] nodes;
+        }
+
+        TwoLockQueue(const TwoLockQueue&) = delete;
+        TwoLockQueue& operator=(const TwoLockQueue&) = delete;
+
+        bool push(const char *data, int datalen) {
+            assert(datalen <= bytesPerLog);
+
+            Lock _(tailMutex);
+            Node *node = waitForNode(_);
+            memcpy(node->array, data, datalen);
+            return enqueue(_, node);
+        }
+
+        // Gathers the fragments into a single element; they may not add
+        // up to more than bytesPerLog.
+        bool pushv(const struct iovec *iov, int iovcnt) {
+            assert(iovLength(iov, iovcnt) <= bytesPerLog);
+
+            Lock _(tailMutex);
+            Node *node = waitForNode(_);
+            gather(node->array, iov, iovcnt);
+            return enqueue(_, node);
+        }
+
+        void peek(int &bytesAvail) {
+            bytesAvail = count.load(std::memory_order_acquire)*bytesPerLog;
+        }
+
+        // Removes the first element, blocking until there is one
+        bool pop(int bytes) {
+            Lock _(headMutex);
+            while (count.load(std::memory_order_acquire) == 0)
+                producedSome.wait(_);
+
+            head = head->next;
+
+            // Pass the wakeup on to the next waiting consumer, if any
+            int before = count.fetch_sub(1, std::memory_order_acq_rel);
+            if (before > 1)
+                producedSome.notify_one();
+            _.unlock();
+
+            // Full -> has space
+            if (before == CAPACITY) {
+                Lock tailLock(tailMutex);
+                consumedSome.notify_one();
+            }
+
+            return true;
+        }
+
+        // Internal; must be invoked with tailMutex held. Blocks until the
+        // node after the tail is free and returns it.
+        Node *waitForNode(Lock &lock) {
+            while (count.load(std::memory_order_acquire) >= CAPACITY)
+                consumedSome.wait(lock);
+
+            return tail->next;
+        }
+
+        // Internal; must be invoked with tailMutex held. Appends the node
+        // returned by waitForNode() and releases the lock.
+        bool enqueue(Lock &lock, Node *node) {
+            tail = node;
+
+            // Pass the wakeup on to the next waiting producer, if any
+            int before = count.fetch_add(1, std::memory_order_acq_rel);
+            if (before + 1 < CAPACITY)
+                consumedSome.notify_one();
+            lock.unlock();
+
+            // Empty -> non-empty
+            if (before == 0) {
+                Lock headLock(headMutex);
+                producedSome.notify_one();
+            }
+
+            return true;
+        }
+    };
+
     struct BasicSpinLock {
         // Atomic flag used to implement a basic spin-lock
         std::atomic_flag lock;
@@ -151,6 +613,7 @@ namespace StagingBuffers {
         int writePos;
         int bytesReadable;
         int endOfWrittenSpace;
+        Reservations reservations;
 
         long bytesPushed;
         long bytesPopped;
@@ -164,6 +627,7 @@ namespace StagingBuffers {
                 , writePos(0)
                 , bytesReadable(0)
                 , endOfWrittenSpace(0)
+                , reservations()
                 , bytesPushed(0)
                 , bytesPopped(0)
         {
@@ -173,8 +637,41 @@ namespace StagingBuffers {
 
         // true means enqueue was successful
         bool push(const char *data, int nbytes);
+        bool pushv(const struct iovec *iov, int iovcnt);
         const char* peek(int &bytesAvail);
         void pop(int nbytes);
+
+        // Fast path of pushv() for a fragment count known at compile time
+        template<size_t N>
+        bool pushv(const struct iovec (&iov)[N]) {
+            int nbytes = iovLength(iov);
+            while (lock.test_and_set(std::memory_order_acquire)) {
+                PerfUtils::Cycles::rdtsc();
+            };  // spin acquire lock with a small (~8ns) backoff
+
+            char *pos = allocateSpace(nbytes);
+            if (pos == nullptr) {
+                lock.clear(std::memory_order_release);
+                return false;
+            }
+
+            gather(pos, iov);
+            bytesPushed += nbytes;
+            bytesReadable += nbytes;
+
+            lock.clear(std::memory_order_release);
+            return true;
+        }
+
+        // nullptr means there was not enough space
+        char *reserveProducerSpace(int nbytes);
+        void finishReservation(const char *pos, int nbytes);
+
+        // Internal; must be invoked with the lock held
+        char *allocateSpace(int nbytes);
+        char *reserveInternal(int nbytes);
+        void finishReservationInternal(const char *pos, int nbytes);
+        void clampToReservations(int &bytesAvail);
     };
 
 
@@ -199,6 +696,9 @@ namespace StagingBuffers {
         long bytesPushed;
         long bytesPopped;
 
+        // Number of times the condition variables were notified
+        uint64_t numNotifies;
+
         char buffer[NanoLogConfig::STAGING_BUFFER_SIZE];
 
         SignalPoll(int id)
@@ -212,14 +712,88 @@ namespace StagingBuffers {
                 , endOfWrittenSpace(0)
                 , bytesPushed(0)
                 , bytesPopped(0)
+                , numNotifies(0)
         {
             bzero(buffer, NanoLogConfig::STAGING_BUFFER_SIZE);
         }
 
         // true means enqueue was successful
         bool push(const char *data, int nbytes);
+        bool pushv(const struct iovec *iov, int iovcnt);
         const char* peek(Lock &lock, int &bytesAvail);
         void pop(int nbytes);
+
+        // Fast path of pushv() for a fragment count known at compile time
+        template<size_t N>
+        bool pushv(const struct iovec (&iov)[N]) {
+            int nbytes = iovLength(iov);
+            Lock _(mutex);
+
+            waitForSpace(_, nbytes);
+            producedSome.notify_one();
+            ++numNotifies;
+
+            gather(&buffer[writePos], iov);
+            bytesPushed += nbytes;
+            bytesReadable += nbytes;
+            writePos += nbytes;
+            return true;
+        }
+
+        // Internal; must be invoked with the lock held
+        void waitForSpace(Lock &lock, int nbytes);
+        bool hasSpaceFor(int nbytes);
+    };
+
+    /**
+     * SignalPoll that only notifies when a push() or pop() may unblock a
+     * waiting thread. Threads count themselves in before they wait, and
+     * the other side notifies them once, after dropping the lock, on the
+     * first operation that changes what they wait for: the first push()
+     * after the consumer found too little data (empty -> non-empty) and
+     * the first pop() after a producer found too little space (full ->
+     * has space). A thread that wakes up and still can't proceed counts
+     * itself in again. With no one waiting, push() and pop() make no
+     * system calls.
+     */
+    struct SignalOnTransition : SignalPoll {
+        // Number of producers and consumers that have started waiting
+        // since they were last notified; protected by mutex
+        int producersWaiting;
+        int consumersWaiting;
+
+        SignalOnTransition(int id)
+                : SignalPoll(id)
+                , producersWaiting(0)
+                , consumersWaiting(0)
+        {
+        }
+
+        // true means enqueue was successful
+        bool push(const char *data, int nbytes);
+        bool pushv(const struct iovec *iov, int iovcnt);
+        void pop(int nbytes);
+
+        // Fast path of pushv() for a fragment count known at compile time;
+        // declared here since the pushv() above hides SignalPoll's
+        template<size_t N>
+        bool pushv(const struct iovec (&iov)[N]) {
+            int nbytes = iovLength(iov);
+            Lock _(mutex);
+
+            waitForSpace(_, nbytes);
+            gather(&buffer[writePos], iov);
+            bool notify = finishPush(nbytes);
+            _.unlock();
+
+            if (notify)
+                producedSome.notify_all();
+            return true;
+        }
+
+        // Internal; must be invoked with the lock held
+        void waitForSpace(Lock &lock, int nbytes);
+        bool finishPush(int nbytes);
     };
 
 }; // StagingBuffers namespace
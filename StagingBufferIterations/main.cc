@@ -14,8 +14,16 @@
  */
 
 #include <cstring>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <queue>
 #include <thread>
+#include <utility>
 #include <vector>
 
 #include <xmmintrin.h>
@@ -25,8 +33,21 @@
 #include "PerfUtils/Util.h"
 
 
+#include "Log.h"
+#include "ConsumerGroup.h"
 #include "StagingBuffers.h"
+#include "StagingBufferRegistry.h"
 #include "SeparatedStagingBuffer.h"
+#include "SegmentedStagingBuffer.h"
+#include "PerCpuStagingBuffer.h"
+#include "PerfCounters.h"
+#include "FastForwardQueue.h"
+#include "DisruptorRing.h"
+#include "Locks.h"
+#include "NodeAggregator.h"
+#include "MpscStagingBuffer.h"
+#include "HybridStagingBufferRegistry.h"
+#include "SequenceStagingBuffer.h"
 
 using namespace NanoLogConfig;
 
@@ -119,6 +140,133 @@ void doPushesTwoStage(int iterations, Buffer *sb)
     }
 }
 
+/**
+ * Splits the datum into NumFragments equally sized pieces to mimic a log
+ * record assembled from a header and several arguments.
+ */
+template<size_t NumFragments>
+void splitDatum(struct iovec (&iov)[NumFragments])
+{
+    static_assert(datum_len % NumFragments == 0,
+                  "datum must split evenly into the fragments");
+
+    for (size_t i = 0; i < NumFragments; ++i) {
+        iov[i].iov_base = const_cast<char*>(datum) +
+                                            i*(datum_len/NumFragments);
+        iov[i].iov_len = datum_len/NumFragments;
+    }
+}
+
+/**
+ * Pushes a fragmented record the way callers had to before pushv(): by
+ * first assembling the fragments into a contiguous staging copy.
+ */
+template<typename Buffer, size_t NumFragments>
+void doPushesStaged(int iterations, Buffer *sb)
+{
+    struct iovec iov[NumFragments];
+    splitDatum(iov);
+
+    for (int i = 0; i < iterations; ++i) {
+        char staging[datum_len];
+        StagingBuffers::gather(staging, iov, NumFragments);
+
+        if (!sb->push(staging, datum_len))
+            --i;
+    }
+}
+
+/**
+ * Pushes a fragmented record with pushv() and a fragment count only known
+ * at runtime.
+ */
+template<typename Buffer, size_t NumFragments>
+void doPushesVectored(int iterations, Buffer *sb)
+{
+    struct iovec iov[NumFragments];
+    splitDatum(iov);
+
+    // Hide the count from the compiler so the generic path is measured
+    volatile int iovcnt = NumFragments;
+
+    for (int i = 0; i < iterations; ++i) {
+        if (!sb->pushv(iov, iovcnt))
+            --i;
+    }
+}
+
+/**
+ * Pushes a fragmented record with the compile-time specialized pushv().
+ */
+template<typename Buffer, size_t NumFragments>
+void doPushesVectoredFixed(int iterations, Buffer *sb)
+{
+    struct iovec iov[NumFragments];
+    splitDatum(iov);
+
+    for (int i = 0; i < iterations; ++i) {
+        if (!sb->pushv(iov))
+            --i;
+    }
+}
+
+/**
+ * Two-stage push that publishes records in batches of BatchSize through a
+ * StagingBuffer::Transaction, paying for one fence and producerPos update
+ * per batch instead of per record.
+ */
+template<typename Buffer, int BatchSize>
+void doPushesBatched(int iterations, Buffer *sb)
+{
+    for (int i = 0; i < iterations; i += BatchSize) {
+        typename Buffer::Transaction txn(*sb);
+
+        for (int j = 0; j < BatchSize && i + j < iterations; ++j) {
+            char *pos = txn.reserveProducerSpace(datum_len);
+            std::memcpy(pos, datum, datum_len);
+            txn.finishReservation(datum_len);
+        }
+    }
+}
+
+/**
+ * Two-stage push for the locked StagingBuffers, whose reserveProducerSpace()
+ * fails rather than blocks when the buffer is full. The copy happens
+ * outside the lock.
+ */
+template<typename Buffer>
+void doPushesLockedTwoStage(int iterations, Buffer *sb)
+{
+    for (int i = 0; i < iterations; ++i) {
+        char *pos = sb->reserveProducerSpace(datum_len);
+        if (pos == nullptr) {
+            --i;
+            continue;
+        }
+
+        std::memcpy(pos, datum, datum_len);
+        sb->finishReservation(pos, datum_len);
+    }
+}
+
+/**
+ * Same as doPushesLockedTwoStage but without copying the datum in, so
+ * that comparing the two separates the cost of the lock from the copy.
+ */
+template<typename Buffer>
+void doPushesLockedReserveOnly(int iterations, Buffer *sb)
+{
+    for (int i = 0; i < iterations; ++i) {
+        char *pos = sb->reserveProducerSpace(datum_len);
+        if (pos == nullptr) {
+            --i;
+            continue;
+        }
+
+        sb->finishReservation(pos, datum_len);
+    }
+}
+
 template<typename Buffer>
 void doConsumesTwoStage(int iterations, Buffer **sbs, int numBuffers)
 {
@@ -137,6 +285,60 @@ void doConsumesTwoStage(int iterations, Buffer **sbs, int numBuffers)
     }
 }
 
+/**
+ * Consumer for buffers of framed records (i.e. SequenceStagingBuffer). It
+ * walks the records in each region peek()-ed; a skip record means the rest
+ * of the region is padding up to the point where the producer wrapped
+ * around.
+ */
+template<typename Buffer>
+void doConsumesFramed(int iterations, Buffer **sbs, int numBuffers)
+{
+    int numConsumed = 0;
+    while (numConsumed < iterations) {
+        for (int j = 0; j < numBuffers; j++) {
+            uint64_t bytesAvail;
+            const char *data = sbs[j]->peek(&bytesAvail);
+
+            uint64_t pos = 0;
+            while (pos < bytesAvail) {
+                auto *header = reinterpret_cast<
+                        const typename Buffer::RecordHeader*>(data + pos);
+                if (header->length == Buffer::SKIP) {
+                    pos = bytesAvail;
+                    break;
+                }
+
+                PerfUtils::Cycles::rdtsc();
+                ++numConsumed;
+                pos += Buffer::recordSize(header->length);
+            }
+
+            if (pos > 0)
+                sbs[j]->consume(pos);
+        }
+    }
+}
+
+/**
+ * Consumer for queues of fixed-size records (i.e. FastForwardQueue) that
+ * hand out one record at a time rather than a range of bytes.
+ */
+template<typename Buffer>
+void doConsumesSlots(int iterations, Buffer **sbs, int numBuffers)
+{
+    int numConsumed = 0;
+    while (numConsumed < iterations) {
+        for (int j = 0; j < numBuffers; j++) {
+            while (sbs[j]->front() != nullptr) {
+                PerfUtils::Cycles::rdtsc();
+                sbs[j]->pop();
+                ++numConsumed;
+            }
+        }
+    }
+}
+
 template<typename Buffer>
 void doConsumesTwoStageBatched(int iterations, Buffer **sbs, int numBuffers)
 {
@@ -158,22 +360,330 @@ void doConsumesTwoStageBatched(int iterations, Buffer **sbs, int numBuffers)
     }
 }
 
+/**
+ * Same as doConsumesTwoStageBatched, but each item is read as a real
+ * consumer would, and the misses are hidden with software prefetches:
+ * the control variables of the buffer BufferDistance ahead are prefetched
+ * before peek()-ing the current one, and data LineDistance cache lines
+ * ahead of the item being read. A distance of 0 disables that prefetch.
+ */
+template<typename Buffer,
+         int BufferDistance = PREFETCH_BUFFER_DISTANCE,
+         int LineDistance = PREFETCH_LINE_DISTANCE>
+void doConsumesPrefetched(int iterations, Buffer **sbs, int numBuffers)
+{
+    const uint64_t lineBytes = BYTES_PER_CACHE_LINE;
+    int numConsumed = 0;
+    volatile char checksum = 0;
+
+    while (numConsumed < iterations) {
+        for (int j = 0; j < numBuffers; j++) {
+            if (BufferDistance > 0)
+                sbs[(j + BufferDistance) % numBuffers]->prefetchForPeek();
+
+            uint64_t bytesAvail;
+            char *data = sbs[j]->peek(&bytesAvail);
+
+            if (bytesAvail >= datum_len) {
+                uint64_t itemsConsumed = bytesAvail/datum_len;
+
+                // Get the first lines of the span in flight together
+                for (int l = 0; l < LineDistance; ++l)
+                    __builtin_prefetch(data + l*lineBytes);
+
+                char localChecksum = 0;
+                for (uint64_t i = 0; i < itemsConsumed; ++i) {
+                    const char *item = data + i*datum_len;
+
+                    // Prefetches never fault, so running past the end of
+                    // the span is harmless.
+                    if (LineDistance > 0 &&
+                            (reinterpret_cast<uintptr_t>(item) % lineBytes)
+                                                                < datum_len)
+                        __builtin_prefetch(item + LineDistance*lineBytes);
+
+                    localChecksum ^= item[0];
+                    PerfUtils::Cycles::rdtsc();
+                }
+                checksum = checksum ^ localChecksum;
+
+                sbs[j]->consume(bytesAvail);
+                numConsumed += itemsConsumed;
+            }
+        }
+    }
+}
+
+// Size of a datum once it's wrapped in a timestamped log entry
+constexpr size_t entry_len = sizeof(Log::UncompressedEntry) + datum_len;
+
+template<typename Buffer>
+void doPushesTimestamped(int iterations, Buffer *sb)
+{
+    for (int i = 0; i < iterations; ++i) {
+        auto *entry = reinterpret_cast<Log::UncompressedEntry*>(
+                                        sb->reserveProducerSpace(entry_len));
+        entry->timestamp = PerfUtils::Cycles::rdtsc();
+        entry->entrySize = entry_len;
+        std::memcpy(entry->argData, datum, datum_len);
+        sb->finishReservation(entry_len);
+    }
+}
+
+/**
+ * Same as doPushesTimestamped, but flushes the producer's unpublished
+ * entries at the end, as a LazyPublishStagingBuffer's owner must before
+ * going idle.
+ */
+template<typename Buffer>
+void doPushesTimestampedLazy(int iterations, Buffer *sb)
+{
+    doPushesTimestamped(iterations, sb);
+    sb->flush();
+}
+
+// Log statement with a fixed argument layout the same size as the datum,
+// so that its entries are interchangeable with doPushesTimestamped's
+using FixedFormatRecord = Log::RecordEncoder<uint64_t, uint32_t, uint16_t,
+                                             char, char>;
+static_assert(FixedFormatRecord::recordSize == entry_len,
+              "encoded record must match the timestamped datum's size");
+
+/**
+ * Same as doPushesTimestamped, but the entry is built by a RecordEncoder
+ * specialized for the argument types at compile time rather than with a
+ * runtime memcpy of the datum.
+ */
+template<typename Buffer>
+void doPushesEncoded(int iterations, Buffer *sb)
+{
+    for (int i = 0; i < iterations; ++i) {
+        FixedFormatRecord::log(sb, PerfUtils::Cycles::rdtsc(),
+                               uint64_t(i), uint32_t(i), uint16_t(i),
+                               'a', '\0');
+    }
+}
+
+/**
+ * Consumer that mimics the NanoLog background thread: it compresses the
+ * timestamped entries from all the buffers into an output buffer and writes
+ * it to DEFAULT_LOG_FILE whenever it fills up. The resulting file can be
+ * read back with the decompressor.
+ */
+template<typename Buffer>
+void doConsumesCompressed(int iterations, Buffer **sbs, int numBuffers)
+{
+    int fd = open(DEFAULT_LOG_FILE, FILE_PARAMS|O_TRUNC, 0666);
+    if (fd < 0) {
+        perror("Unable to open log file");
+        exit(1);
+    }
+
+    char *outputBuffer = static_cast<char*>(malloc(OUTPUT_BUFFER_SIZE));
+    Log::Encoder encoder(outputBuffer, OUTPUT_BUFFER_SIZE,
+                         PerfUtils::Cycles::getCyclesPerSec());
+
+    int numConsumed = 0;
+    while (numConsumed < iterations) {
+        for (int j = 0; j < numBuffers; j++) {
+            uint64_t bytesAvail;
+            char *peekPos = sbs[j]->peek(&bytesAvail);
+
+            if (bytesAvail < entry_len)
+                continue;
+
+            uint64_t numEvents;
+            uint64_t bytesConsumed = encoder.encodeLogMsgs(peekPos, bytesAvail,
+                                                           sbs[j]->getId(),
+                                                           &numEvents);
+            if (bytesConsumed == 0) {
+                if (write(fd, outputBuffer, encoder.getEncodedBytes()) < 0)
+                    perror("Log file write failed");
+                encoder.swapBuffer(outputBuffer, OUTPUT_BUFFER_SIZE);
+                continue;
+            }
+
+            sbs[j]->consume(bytesConsumed);
+            numConsumed += numEvents;
+        }
+    }
+
+    if (write(fd, outputBuffer, encoder.getEncodedBytes()) < 0)
+        perror("Log file write failed");
+
+    close(fd);
+    free(outputBuffer);
+}
+
+template<typename Buffer>
+void doConsumesTimestampedBatched(int iterations, Buffer **sbs, int numBuffers)
+{
+    int numConsumed = 0;
+    while (numConsumed < iterations) {
+        for (int j = 0; j < numBuffers; j++) {
+            uint64_t bytesAvail;
+            sbs[j]->peek(&bytesAvail);
+
+            if (bytesAvail >= entry_len) {
+                uint64_t itemsConsumed = bytesAvail/entry_len;
+                for (uint64_t i = 0; i < itemsConsumed; ++i)
+                    PerfUtils::Cycles::rdtsc();
+
+                sbs[j]->consume(bytesAvail);
+                numConsumed += itemsConsumed;
+            }
+        }
+    }
+}
+
+// Results of the last doConsumesVisibility(); see runVisibilityTest
+static uint64_t visibilityCycles = 0;
+static uint64_t numRefills = 0;
+
+/**
+ * Same as doConsumesTimestampedBatched, but measures how long each entry
+ * took to become visible, i.e. the time between the producer's timestamp
+ * and the peek() that first returned the entry. The total is left in
+ * visibilityCycles and the number of peek()s that returned new entries
+ * (each of which pulls the producer's cache line) in numRefills.
+ */
+template<typename Buffer>
+void doConsumesVisibility(int iterations, Buffer **sbs, int numBuffers)
+{
+    visibilityCycles = 0;
+    numRefills = 0;
+
+    int numConsumed = 0;
+    while (numConsumed < iterations) {
+        for (int j = 0; j < numBuffers; j++) {
+            uint64_t bytesAvail;
+            char *peekPos = sbs[j]->peek(&bytesAvail);
+
+            if (bytesAvail >= entry_len) {
+                uint64_t now = PerfUtils::Cycles::rdtsc();
+                uint64_t itemsConsumed = bytesAvail/entry_len;
+                for (uint64_t i = 0; i < itemsConsumed; ++i) {
+                    auto *entry = reinterpret_cast<Log::UncompressedEntry*>(
+                                                    peekPos + i*entry_len);
+                    visibilityCycles += now - entry->timestamp;
+                }
+
+                sbs[j]->consume(itemsConsumed*entry_len);
+                numConsumed += itemsConsumed;
+                ++numRefills;
+            }
+        }
+    }
+}
+
+/**
+ * Consumer that emits the timestamped entries in global timestamp order
+ * instead of draining the buffers round-robin. A min-heap holds the head
+ * entry of every non-empty buffer keyed by its rdtsc timestamp. Since an
+ * empty buffer may still receive an entry older than the heap's minimum,
+ * the minimum is only emitted once every buffer has an entry in the heap
+ * or the entry is older than the reordering window.
+ *
+ * \tparam windowNs
+ *      Maximum time a producer may take between reading its timestamp and
+ *      publishing the entry for the output to remain ordered
+ */
+template<typename Buffer, uint64_t windowNs>
+void doConsumesOrdered(int iterations, Buffer **sbs, int numBuffers)
+{
+    using HeapEntry = std::pair<uint64_t, int>;  // (timestamp, buffer index)
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>,
+                        std::greater<HeapEntry>> heap;
+
+    // Contiguous span peek()-ed from each buffer and how far into it the
+    // consumer has gotten; the span is only consume()-ed once exhausted.
+    std::vector<char*> spanStart(numBuffers, nullptr);
+    std::vector<uint64_t> spanBytes(numBuffers, 0);
+    std::vector<uint64_t> spanOffset(numBuffers, 0);
+
+    // Peeks the next entry of buffer j and adds it to the heap if present
+    auto refill = [&](int j) {
+        if (spanOffset[j] == spanBytes[j]) {
+            if (spanBytes[j] > 0)
+                sbs[j]->consume(spanBytes[j]);
+
+            spanOffset[j] = 0;
+            spanStart[j] = sbs[j]->peek(&spanBytes[j]);
+            if (spanBytes[j] < entry_len) {
+                spanBytes[j] = 0;
+                return false;
+            }
+        }
+
+        auto *entry = reinterpret_cast<Log::UncompressedEntry*>(
+                                            spanStart[j] + spanOffset[j]);
+        uint64_t timestamp = entry->timestamp;
+        heap.emplace(timestamp, j);
+        return true;
+    };
+
+    const uint64_t windowCycles = PerfUtils::Cycles::fromNanoseconds(windowNs);
+    uint64_t lastTimestamp = 0;
+    uint64_t outOfOrder = 0;
+    int numConsumed = 0;
+    int numMissing = numBuffers;
+
+    while (numConsumed < iterations) {
+        if (numMissing > 0) {
+            for (int j = 0; j < numBuffers; ++j)
+                if (spanOffset[j] == spanBytes[j] && refill(j))
+                    --numMissing;
+        }
+
+        if (heap.empty())
+            continue;
+
+        HeapEntry next = heap.top();
+        if (numMissing > 0 &&
+                PerfUtils::Cycles::rdtsc() - next.first < windowCycles)
+            continue;
+
+        heap.pop();
+        int j = next.second;
+        auto *entry = reinterpret_cast<Log::UncompressedEntry*>(
+                                            spanStart[j] + spanOffset[j]);
+        spanOffset[j] += entry->entrySize;
+
+        if (entry->timestamp < lastTimestamp)
+            ++outOfOrder;
+        lastTimestamp = entry->timestamp;
+        PerfUtils::Cycles::rdtsc();
+        ++numConsumed;
+
+        if (!refill(j))
+            ++numMissing;
+    }
+
+    for (int j = 0; j < numBuffers; ++j)
+        if (spanOffset[j] > 0)
+            sbs[j]->consume(spanOffset[j]);
+
+    if (outOfOrder > 0)
+        fprintf(stderr, "# %lu entries were emitted outside of the %lu ns "
+                        "reordering window\r\n", outOfOrder, windowNs);
+}
+
 template<typename Buffer>
-void pusherMain(int id, pthread_barrier_t *barrier, Buffer *sb,
+void pusherMain(int id, int iterations, pthread_barrier_t *barrier, Buffer *sb,
                 void (*doPushes)(int, Buffer *), Metrics *m)
 {
     uint64_t start, stop;
     double time;
 
-    PerfUtils::Util::pinThreadToCore(id);
+    PerfUtils::Util::pinThreadToCore(id % std::thread::hardware_concurrency());
     pthread_barrier_wait(barrier);
 
     start = PerfUtils::Cycles::rdtsc();
-    doPushes(ITERATIONS/BENCHMARK_THREADS, sb);
+    doPushes(iterations, sb);
     stop = PerfUtils::Cycles::rdtsc();
 
     m->threadId = id;
-    m->numOps = ITERATIONS/BENCHMARK_THREADS;
+    m->numOps = iterations;
     m->totalCycles = stop - start;
 }
 
@@ -198,7 +708,8 @@ void runTest(const char *testName,
 
         Buffer *bufferToUse = (runIndividualBuffers) ? buffers[i] : buffers[0];
         threads.emplace_back(pusherMain<Buffer>, i,
-                             &barrier, bufferToUse, benchOp, &pushMetrics[i]);
+                             ITERATIONS/BENCHMARK_THREADS, &barrier,
+                             bufferToUse, benchOp, &pushMetrics[i]);
     }
 
     // Consumer Start
@@ -222,7 +733,7 @@ void runTest(const char *testName,
             threads.at(i).join();
 
     for (int i = 0; i < BENCHMARK_THREADS; ++i) {
-        free(buffers[i]);
+        delete buffers[i];
         buffers[i] = nullptr;
     }
 
@@ -241,47 +752,1827 @@ void runTest(const char *testName,
            pushTotals.getAvgLatencyInNs()/BENCHMARK_THREADS);
 }
 
-int main(int argc, char** argv) {
-    constexpr uint64_t numOps = BENCHMARK_THREADS*(ITERATIONS/BENCHMARK_THREADS);
-    char hostname[256];
-    if (gethostname(hostname, 256))
-        bzero(hostname, 256); // Null out the string if an error occurs
+/**
+ * Consumer thread for runMultiConsumerTest. It drains the buffers in its
+ * shard of the ConsumerGroup and steals from other shards when it finds
+ * nothing to do.
+ */
+template<typename Buffer>
+void multiConsumerMain(int id, int coreId, uint64_t iterations,
+                       pthread_barrier_t *barrier,
+                       Alternatives::ConsumerGroup<Buffer> *group,
+                       std::atomic<uint64_t> *numConsumed)
+{
+    auto process = [](char *data, uint64_t bytesAvail) {
+        uint64_t itemsConsumed = bytesAvail/datum_len;
+        for (uint64_t i = 0; i < itemsConsumed; ++i)
+            PerfUtils::Cycles::rdtsc();
 
-    printf("# Benchmarks the NanoLog StagingBuffer with certain optimizations "
-           "disabled.\r\n"
-           "# It mocks the NanoLog operations by utilizing multiple threads to"
-           " push fixed\r\n"
-           "# size data to a buffer and a separate thread to pop them back out."
-           "\r\n"
-           "# The average operation time is reported.\r\n"
-           "#\r\n"
-           "# - Configuration -\r\n"
-           "# Number of push operations: %0.2lf KOps\r\n"
-           "# Number of threads: %d\r\n"
-           "# Datum: \"%s\"\r\n"
-           "# Datum size: %ld Bytes\r\n"
-           "# Staging Buffer Size: %0.3lf KB\r\n"
-           "# Benchmark machine hostname: %s",
-           numOps/1.0e3,
-           BENCHMARK_THREADS,
-           datum,
-           datum_len,
-           NanoLogConfig::STAGING_BUFFER_SIZE/1.0e3,
-           hostname);
+        return itemsConsumed*datum_len;
+    };
 
-    printf("\r\n\r\n# %-18s %10s %10s %15s %15s\r\n",
-            "Condition", "Global", "Num Ops", "Consume (ns)", "Push Avg (ns)");
+    PerfUtils::Util::pinThreadToCore(coreId);
+    pthread_barrier_wait(barrier);
 
-    runTest<StagingBuffers::Basic>("Basic", true, &doPushes, &doConsumes);
-    runTest<StagingBuffers::Basic>("Basic", false, &doPushes, &doConsumes);
-    runTest<StagingBuffers::StdDeque<datum_len>>("Deque", true, &doPushes, &doConsumes);
-    runTest<StagingBuffers::StdDeque<datum_len>>("Deque", false, &doPushes, &doConsumes);
-    runTest<StagingBuffers::SignalPoll>("Signaler", true, &doPushesCond, &doConsumesCond);
-    runTest<StagingBuffers::SignalPoll>("Signaler", false, &doPushesCond, &doConsumesCond);
+    while (numConsumed->load(std::memory_order_relaxed) < iterations) {
+        uint64_t bytesConsumed = group->drain(id, process);
+        if (bytesConsumed == 0)
+            bytesConsumed = group->steal(id, process);
+
+        if (bytesConsumed > 0)
+            numConsumed->fetch_add(bytesConsumed/datum_len);
+    }
+}
+
+/**
+ * Measures how the consumer throughput scales when the per-thread buffers
+ * of many producers are sharded across multiple consumer threads.
+ *
+ * \param numProducers
+ *      Number of producer threads, each with its own buffer
+ * \param numConsumers
+ *      Number of consumer threads to shard the buffers across
+ */
+template<typename Buffer>
+void runMultiConsumerTest(int numProducers, int numConsumers)
+{
+    const int numCores = std::thread::hardware_concurrency();
+    const int iterationsPerProducer = ITERATIONS/numProducers;
+    const uint64_t totalIterations = iterationsPerProducer*numProducers;
+
+    pthread_barrier_t barrier;
+    if (pthread_barrier_init(&barrier, NULL, numProducers + numConsumers + 1)) {
+        printf("pthread error\r\n");
+    }
+
+    std::vector<Buffer*> buffers(numProducers);
+    std::vector<Metrics> pushMetrics(numProducers);
+    for (int i = 0; i < numProducers; ++i)
+        buffers[i] = new Buffer(i);
+
+    Alternatives::ConsumerGroup<Buffer> group(buffers.data(), numProducers,
+                                              numConsumers);
+    std::atomic<uint64_t> numConsumed(0);
+
+    // Consumers get the first cores so that they're never time sliced with
+    // each other; the producers wrap around the cores that are left. pusherMain
+    // pins to its id modulo the core count, so the id passed in is the core.
+    const int producerCores = numCores - numConsumers;
+    if (producerCores <= 0 || numConsumers + numProducers > numCores)
+        fprintf(stderr, "# %d consumers and %d producers oversubscribe %d "
+                        "cores\r\n", numConsumers, numProducers, numCores);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numConsumers; ++i) {
+        threads.emplace_back(multiConsumerMain<Buffer>, i, i % numCores,
+                             totalIterations, &barrier, &group, &numConsumed);
+    }
+
+    for (int i = 0; i < numProducers; ++i) {
+        int coreId = (producerCores > 0) ? numConsumers + i % producerCores
+                                         : i % numCores;
+        threads.emplace_back(pusherMain<Buffer>, coreId,
+                             iterationsPerProducer, &barrier, buffers[i],
+                             &doPushesTwoStage<Buffer>, &pushMetrics[i]);
+    }
+
+    pthread_barrier_wait(&barrier);
+    uint64_t start = PerfUtils::Cycles::rdtsc();
+    for (int i = 0; i < numConsumers; ++i)
+        threads[i].join();
+    uint64_t stop = PerfUtils::Cycles::rdtsc();
+
+    for (int i = numConsumers; i < threads.size(); ++i)
+        threads[i].join();
+
+    for (int i = 0; i < numProducers; ++i)
+        delete buffers[i];
+
+    Metrics pushTotals = {};
+    for (int i = 0 ; i < numProducers; ++i) {
+        pushTotals.totalCycles += pushMetrics[i].totalCycles;
+        pushTotals.numOps += pushMetrics[i].numOps;
+    }
+
+    double seconds = PerfUtils::Cycles::toSeconds(stop - start);
+    printf("%-19d %10d %10lu %15.2lf %15.2lf %10lu\r\n",
+           numConsumers,
+           numProducers,
+           totalIterations,
+           totalIterations/seconds/1.0e6,
+           pushTotals.getAvgLatencyInNs(),
+           group.getNumSteals());
+}
+
+/**
+ * Body of the short-lived threads in the thread churn benchmark. Each log
+ * invocation finds the thread's StagingBuffer through the registry (which
+ * allocates it on the first invocation) as NanoLog does.
+ *
+ * \param createTime
+ *      rdtsc() value taken just before the thread was created
+ * \param[out] firstLogCycles
+ *      Cycles from createTime until the first log invocation completed
+ */
+template<typename Registry>
+void churnThreadMain(uint64_t createTime, uint64_t *firstLogCycles)
+{
+    for (int i = 0; i < CHURN_PUSHES_PER_THREAD; ++i) {
+        auto *sb = Registry::getStagingBuffer();
+        char *pos = sb->reserveProducerSpace(datum_len);
+        std::memcpy(pos, datum, datum_len);
+        sb->finishReservation(datum_len);
+
+        if (i == 0)
+            *firstLogCycles = PerfUtils::Cycles::rdtsc() - createTime;
+    }
+}
+
+/**
+ * Measures the cost of thread churn on the StagingBuffer registry:
+ * short-lived threads are created in waves of BENCHMARK_THREADS, each
+ * lazily allocating a StagingBuffer, push()-ing a few items and exiting.
+ * A consumer thread drains the buffers and reclaims them behind the
+ * exiting threads.
+ */
+template<typename Registry>
+void runThreadChurnTest(const char *testName)
+{
+    const uint64_t totalPushes = uint64_t(CHURN_THREADS)*
+                                                    CHURN_PUSHES_PER_THREAD;
+    Registry::resetStats();
+
+    std::thread consumer([totalPushes]() {
+        auto process = [](char *data, uint64_t bytesAvail) {
+            uint64_t itemsConsumed = bytesAvail/datum_len;
+            for (uint64_t i = 0; i < itemsConsumed; ++i)
+                PerfUtils::Cycles::rdtsc();
+
+            return itemsConsumed*datum_len;
+        };
+
+        uint64_t numConsumed = 0;
+        while (numConsumed < totalPushes || Registry::getNumBuffers() > 0)
+            numConsumed += Registry::drain(process)/datum_len;
+    });
+
+    std::vector<uint64_t> firstLogCycles(CHURN_THREADS);
+    uint64_t lifetimeCycles = 0;
+    uint64_t start = PerfUtils::Cycles::rdtsc();
+    for (int i = 0; i < CHURN_THREADS; i += BENCHMARK_THREADS) {
+        std::vector<std::thread> threads;
+        uint64_t waveStart = PerfUtils::Cycles::rdtsc();
+        for (int j = i; j < std::min(i + BENCHMARK_THREADS, CHURN_THREADS); ++j)
+            threads.emplace_back(churnThreadMain<Registry>,
+                                 PerfUtils::Cycles::rdtsc(),
+                                 &firstLogCycles[j]);
+
+        for (auto &thread : threads)
+            thread.join();
+
+        lifetimeCycles += (PerfUtils::Cycles::rdtsc() - waveStart)*
+                                                            threads.size();
+    }
+    consumer.join();
+    uint64_t stop = PerfUtils::Cycles::rdtsc();
+
+    uint64_t totalFirstLogCycles = 0;
+    for (uint64_t cycles : firstLogCycles)
+        totalFirstLogCycles += cycles;
+
+    printf("%-19s %10d %10lu %15.2lf %15.2lf %15.2lf %10lu %10lu\r\n",
+           testName,
+           CHURN_THREADS,
+           totalPushes,
+           PerfUtils::Cycles::toSeconds(stop - start)*1.0e9/totalPushes,
+           PerfUtils::Cycles::toSeconds(totalFirstLogCycles)*1.0e9/
+                                                                CHURN_THREADS,
+           PerfUtils::Cycles::toSeconds(lifetimeCycles)*1.0e6/CHURN_THREADS,
+           Registry::getMaxNumBuffers(),
+           Registry::getNumBuffersAllocated());
+}
+
+/**
+ * Producer for the bursty workload. It push()-es BURST_BYTES of data as
+ * fast as it can and then idles, NUM_BURSTS times over, recording how long
+ * each burst took so that stalls behind the consumer show up.
+ *
+ * \param[out] m
+ *      Total pushes and cycles spent in bursts
+ * \param[out] maxBurstCycles
+ *      Duration of the longest burst
+ */
+template<typename Buffer>
+void burstPusherMain(int id, pthread_barrier_t *barrier, Buffer *sb,
+                     Metrics *m, uint64_t *maxBurstCycles)
+{
+    const int pushesPerBurst = BURST_BYTES/datum_len;
+    const uint64_t idleCycles = PerfUtils::Cycles::fromNanoseconds(
+                                                        BURST_IDLE_US*1000);
+
+    PerfUtils::Util::pinThreadToCore(id % std::thread::hardware_concurrency());
+    pthread_barrier_wait(barrier);
+
+    *maxBurstCycles = 0;
+    for (int burst = 0; burst < NUM_BURSTS; ++burst) {
+        uint64_t start = PerfUtils::Cycles::rdtsc();
+        doPushesTwoStage(pushesPerBurst, sb);
+        uint64_t stop = PerfUtils::Cycles::rdtsc();
+
+        m->numOps += pushesPerBurst;
+        m->totalCycles += stop - start;
+        *maxBurstCycles = std::max(*maxBurstCycles, stop - start);
+
+        while (PerfUtils::Cycles::rdtsc() - stop < idleCycles);
+    }
+}
+
+/**
+ * Runs the bursty workload against per-thread buffers and reports the
+ * producer's push latency during bursts, the total time the producers
+ * were blocked waiting for space and the memory the buffers used.
+ *
+ * \param buffers
+ *      One buffer per BENCHMARK_THREADS producer
+ * \param bytesUsed
+ *      Returns the peak number of bytes allocated for the buffers
+ * \param countsBlocking
+ *      false if the buffers don't keep cyclesProducerBlocked in this build
+ */
+template<typename Buffer>
+void runBurstTest(const char *testName, Buffer **buffers,
+                  uint64_t (*bytesUsed)(), bool countsBlocking)
+{
+    const uint64_t totalPushes = uint64_t(BENCHMARK_THREADS)*NUM_BURSTS*
+                                                    (BURST_BYTES/datum_len);
+    pthread_barrier_t barrier;
+    if (pthread_barrier_init(&barrier, NULL, BENCHMARK_THREADS + 1)) {
+        printf("pthread error\r\n");
+    }
+
+    std::vector<std::thread> threads;
+    Metrics pushMetrics[BENCHMARK_THREADS];
+    uint64_t maxBurstCycles[BENCHMARK_THREADS];
+    for (int i = 0; i < BENCHMARK_THREADS; ++i) {
+        threads.emplace_back(burstPusherMain<Buffer>, i, &barrier, buffers[i],
+                             &pushMetrics[i], &maxBurstCycles[i]);
+    }
+
+    PerfUtils::Util::pinThreadToCore(BENCHMARK_THREADS);
+    pthread_barrier_wait(&barrier);
+    doConsumesTwoStageBatched(totalPushes, buffers, BENCHMARK_THREADS);
+
+    for (auto &thread : threads)
+        thread.join();
+
+    Metrics pushTotals = {};
+    uint64_t maxBurst = 0;
+    uint64_t cyclesBlocked = 0;
+    for (int i = 0 ; i < BENCHMARK_THREADS; ++i) {
+        pushTotals.totalCycles += pushMetrics[i].totalCycles;
+        pushTotals.numOps += pushMetrics[i].numOps;
+        maxBurst = std::max(maxBurst, maxBurstCycles[i]);
+        cyclesBlocked += buffers[i]->cyclesProducerBlocked;
+    }
+
+    char blockedStr[32] = "n/a";
+    if (countsBlocking)
+        snprintf(blockedStr, sizeof(blockedStr), "%.2lf",
+                 PerfUtils::Cycles::toSeconds(cyclesBlocked)*1.0e6);
+
+    printf("%-19s %10lu %15.2lf %15.2lf %15s %15.3lf\r\n",
+           testName,
+           totalPushes,
+           pushTotals.getAvgLatencyInNs(),
+           PerfUtils::Cycles::toSeconds(maxBurst)*1.0e6,
+           blockedStr,
+           bytesUsed()/1.0e6);
+}
+
+/**
+ * Producer for the per-CPU buffer benchmark. Unlike pusherMain, the thread
+ * is left unpinned so that the scheduler is free to migrate it and the
+ * rseq critical sections in push() get exercised.
+ *
+ * \param[out] m
+ *      Total pushes and cycles spent pushing
+ */
+void perCpuPusherMain(pthread_barrier_t *barrier,
+                      Alternatives::PerCpuStagingBuffer *sb, Metrics *m)
+{
+    pthread_barrier_wait(barrier);
+
+    uint64_t start = PerfUtils::Cycles::rdtsc();
+    for (int i = 0; i < PER_CPU_PUSHES_PER_THREAD; ++i)
+        sb->push(datum, datum_len);
+    uint64_t stop = PerfUtils::Cycles::rdtsc();
+
+    m->numOps = PER_CPU_PUSHES_PER_THREAD;
+    m->totalCycles = stop - start;
+}
+
+/**
+ * Producer for the per-thread side of the per-CPU buffer benchmark; the
+ * same as perCpuPusherMain but with a StagingBuffer owned by the thread.
+ */
+template<typename Buffer>
+void perThreadPusherMain(pthread_barrier_t *barrier, Buffer *sb, Metrics *m)
+{
+    pthread_barrier_wait(barrier);
+
+    uint64_t start = PerfUtils::Cycles::rdtsc();
+    doPushesTwoStage(PER_CPU_PUSHES_PER_THREAD, sb);
+    uint64_t stop = PerfUtils::Cycles::rdtsc();
+
+    m->numOps = PER_CPU_PUSHES_PER_THREAD;
+    m->totalCycles = stop - start;
+}
+
+/**
+ * Reports the results of a per-CPU vs. per-thread buffer run.
+ */
+static void
+printPerCpuResult(const char *testName, uint64_t totalPushes,
+                  uint64_t totalCycles, Metrics *pushMetrics,
+                  uint64_t bytesAllocated, uint64_t restarts)
+{
+    Metrics pushTotals = {};
+    for (int i = 0 ; i < PER_CPU_THREADS; ++i) {
+        pushTotals.totalCycles += pushMetrics[i].totalCycles;
+        pushTotals.numOps += pushMetrics[i].numOps;
+    }
+
+    printf("%-19s %10d %10lu %15.2lf %15.2lf %15.3lf %10lu\r\n",
+           testName,
+           PER_CPU_THREADS,
+           totalPushes,
+           totalPushes/PerfUtils::Cycles::toSeconds(totalCycles)/1.0e6,
+           pushTotals.getAvgLatencyInNs(),
+           bytesAllocated/1.0e6,
+           restarts);
+}
+
+/**
+ * Compares per-CPU buffers committed with rseq against one
+ * Alternatives::StagingBuffer per thread, with PER_CPU_THREADS unpinned
+ * producers alive at once. The buffer memory of the former is bounded by
+ * the number of cores rather than the number of threads.
+ */
+void runPerCpuTest()
+{
+    const uint64_t totalPushes = uint64_t(PER_CPU_THREADS)*
+                                                PER_CPU_PUSHES_PER_THREAD;
+    std::vector<Metrics> pushMetrics(PER_CPU_THREADS);
+    pthread_barrier_t barrier;
+
+    if (!Alternatives::PerCpuStagingBuffer::isSupported()) {
+        printf("%-19s %s\r\n", "Per-CPU rseq",
+               "skipped (rseq is not registered by libc)");
+    } else {
+        Alternatives::PerCpuStagingBuffer sb;
+        if (pthread_barrier_init(&barrier, NULL, PER_CPU_THREADS + 1)) {
+            printf("pthread error\r\n");
+        }
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < PER_CPU_THREADS; ++i)
+            threads.emplace_back(perCpuPusherMain, &barrier, &sb,
+                                 &pushMetrics[i]);
+
+        pthread_barrier_wait(&barrier);
+        uint64_t start = PerfUtils::Cycles::rdtsc();
+        uint64_t numConsumed = 0;
+        while (numConsumed < totalPushes) {
+            for (int cpu = 0; cpu < sb.getNumCpus(); ++cpu) {
+                numConsumed += sb.drain(cpu, [](const char *, uint32_t) {
+                    PerfUtils::Cycles::rdtsc();
+                });
+            }
+        }
+        uint64_t stop = PerfUtils::Cycles::rdtsc();
+
+        for (auto &thread : threads)
+            thread.join();
+        pthread_barrier_destroy(&barrier);
+
+        printPerCpuResult("Per-CPU rseq", totalPushes, stop - start,
+                          pushMetrics.data(), sb.getBytesAllocated(),
+                          sb.getNumRestarts());
+    }
+
+    {
+        using Buffer = Alternatives::StagingBuffer<64>;
+        std::vector<Buffer*> sbs(PER_CPU_THREADS);
+        for (int i = 0; i < PER_CPU_THREADS; ++i)
+            sbs[i] = new Buffer(i);
+
+        if (pthread_barrier_init(&barrier, NULL, PER_CPU_THREADS + 1)) {
+            printf("pthread error\r\n");
+        }
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < PER_CPU_THREADS; ++i)
+            threads.emplace_back(perThreadPusherMain<Buffer>, &barrier,
+                                 sbs[i], &pushMetrics[i]);
+
+        pthread_barrier_wait(&barrier);
+        uint64_t start = PerfUtils::Cycles::rdtsc();
+        doConsumesTwoStageBatched(totalPushes, sbs.data(), PER_CPU_THREADS);
+        uint64_t stop = PerfUtils::Cycles::rdtsc();
+
+        for (auto &thread : threads)
+            thread.join();
+        pthread_barrier_destroy(&barrier);
+
+        printPerCpuResult("Per-Thread", totalPushes, stop - start,
+                          pushMetrics.data(),
+                          uint64_t(PER_CPU_THREADS)*STAGING_BUFFER_SIZE, 0);
+
+        for (auto *sb : sbs)
+            delete sb;
+    }
+}
+
+/**
+ * Producer for the prefetching benchmark. The thread owns every
+ * numThreads-th buffer starting at id and pushes to them round-robin, so
+ * that each buffer still has a single producer.
+ *
+ * \param[out] m
+ *      Total pushes and cycles spent pushing
+ */
+template<typename Buffer>
+void roundRobinPusherMain(int id, int numThreads, int iterations,
+                          pthread_barrier_t *barrier, Buffer **buffers,
+                          int numBuffers, Metrics *m)
+{
+    PerfUtils::Util::pinThreadToCore(id % std::thread::hardware_concurrency());
+    pthread_barrier_wait(barrier);
+
+    int numOwned = (numBuffers - id + numThreads - 1)/numThreads;
+    uint64_t start = PerfUtils::Cycles::rdtsc();
+    for (int i = 0; i < iterations; ++i) {
+        Buffer *sb = buffers[id + (i % numOwned)*numThreads];
+        char *pos = sb->reserveProducerSpace(datum_len);
+        std::memcpy(pos, datum, datum_len);
+        sb->finishReservation(datum_len);
+    }
+    uint64_t stop = PerfUtils::Cycles::rdtsc();
+
+    m->numOps = iterations;
+    m->totalCycles = stop - start;
+}
+
+/**
+ * Runs BENCHMARK_THREADS producers spread over numBuffers StagingBuffers
+ * and measures how long consumeOp takes to drain them. This shows how the
+ * consumer's cache misses on the buffers grow with their number.
+ */
+template<typename Buffer>
+void runPrefetchTest(const char *testName, int numBuffers,
+                     void (*consumeOp)(int,Buffer**,int))
+{
+    const int numThreads = std::min(BENCHMARK_THREADS, numBuffers);
+    const int perThread = ITERATIONS/numThreads;
+    pthread_barrier_t barrier;
+    if (pthread_barrier_init(&barrier, NULL, numThreads + 1)) {
+        printf("pthread error\r\n");
+    }
+
+    std::vector<Buffer*> buffers(numBuffers);
+    for (int i = 0; i < numBuffers; ++i)
+        buffers[i] = new Buffer(i);
+
+    std::vector<std::thread> threads;
+    std::vector<Metrics> pushMetrics(numThreads);
+    for (int i = 0; i < numThreads; ++i)
+        threads.emplace_back(roundRobinPusherMain<Buffer>, i, numThreads,
+                             perThread, &barrier, buffers.data(), numBuffers,
+                             &pushMetrics[i]);
+
+    PerfUtils::Util::pinThreadToCore(BENCHMARK_THREADS);
+    pthread_barrier_wait(&barrier);
+
+    Metrics popMetrics = {};
+    popMetrics.numOps = uint64_t(numThreads)*perThread;
+    uint64_t start = PerfUtils::Cycles::rdtsc();
+    consumeOp(popMetrics.numOps, buffers.data(), numBuffers);
+    popMetrics.totalCycles = PerfUtils::Cycles::rdtsc() - start;
+
+    for (auto &thread : threads)
+        thread.join();
+
+    Metrics pushTotals = {};
+    for (int i = 0; i < numThreads; ++i) {
+        pushTotals.totalCycles += pushMetrics[i].totalCycles;
+        pushTotals.numOps += pushMetrics[i].numOps;
+    }
+
+    for (Buffer *sb : buffers)
+        delete sb;
+
+    printf("%-19s %10d %10lu %15.2lf %15.2lf\r\n",
+           testName,
+           numBuffers,
+           popMetrics.numOps,
+           popMetrics.getAvgLatencyInNs(),
+           pushTotals.getAvgLatencyInNs()/numThreads);
+}
+
+/**
+ * Producer for the large record benchmark. Between pushes, it walks a
+ * private working set the way an application thread would between log
+ * statements, measuring how long the walk takes and how often it misses
+ * in the L1 cache because the record copies evicted it.
+ *
+ * \tparam NonTemporal
+ *      Whether push() may use streaming stores for the large records
+ * \param[out] pushMetrics
+ *      Total pushes and cycles spent in push()
+ * \param[out] walkMetrics
+ *      Total working set walks and cycles spent in them
+ * \param[out] walkMisses
+ *      L1D read misses during the walks, or ~0 if unavailable
+ */
+template<bool NonTemporal>
+void largeRecordPusherMain(int id, pthread_barrier_t *barrier,
+                           Alternatives::StagingBuffer<64> *sb,
+                           Metrics *pushMetrics, Metrics *walkMetrics,
+                           uint64_t *walkMisses)
+{
+    const int iterations = LARGE_RECORD_PUSHES/BENCHMARK_THREADS;
+    const size_t threshold = (NonTemporal) ? NON_TEMPORAL_THRESHOLD : SIZE_MAX;
+    std::vector<char> record(LARGE_RECORD_SIZE, 'x');
+    std::vector<uint64_t> workingSet(PRODUCER_WORKING_SET/sizeof(uint64_t), 1);
+    PerfCounter misses = PerfCounter::l1dReadMisses();
+
+    PerfUtils::Util::pinThreadToCore(id % std::thread::hardware_concurrency());
+    pthread_barrier_wait(barrier);
+
+    volatile uint64_t sum = 0;
+    *walkMisses = 0;
+    for (int i = 0; i < iterations; ++i) {
+        uint64_t start = PerfUtils::Cycles::rdtsc();
+        sb->push(record.data(), LARGE_RECORD_SIZE, threshold);
+        uint64_t stop = PerfUtils::Cycles::rdtsc();
+        pushMetrics->totalCycles += stop - start;
+
+        misses.start();
+        start = PerfUtils::Cycles::rdtsc();
+        for (size_t j = 0; j < workingSet.size(); j += 8)
+            sum = sum + workingSet[j];
+        stop = PerfUtils::Cycles::rdtsc();
+        *walkMisses += misses.stop();
+        walkMetrics->totalCycles += stop - start;
+    }
+
+    pushMetrics->numOps = iterations;
+    walkMetrics->numOps = iterations;
+    if (!misses.isValid())
+        *walkMisses = ~0lu;
+}
+
+/**
+ * Compares copying large records into the StagingBuffers through the
+ * cache against streaming them with non-temporal stores. Reports the
+ * producers' push latency, the cost of their own working set walks and
+ * the consumer's cost to read each record back in full.
+ */
+template<bool NonTemporal>
+void runLargeRecordTest(const char *testName)
+{
+    const uint64_t totalPushes = BENCHMARK_THREADS*
+                                (LARGE_RECORD_PUSHES/BENCHMARK_THREADS);
+    pthread_barrier_t barrier;
+    if (pthread_barrier_init(&barrier, NULL, BENCHMARK_THREADS + 1)) {
+        printf("pthread error\r\n");
+    }
+
+    std::vector<std::thread> threads;
+    Alternatives::StagingBuffer<64> *buffers[BENCHMARK_THREADS];
+    Metrics pushMetrics[BENCHMARK_THREADS];
+    Metrics walkMetrics[BENCHMARK_THREADS];
+    uint64_t walkMisses[BENCHMARK_THREADS];
+    for (int i = 0; i < BENCHMARK_THREADS; ++i) {
+        buffers[i] = new Alternatives::StagingBuffer<64>(i);
+        threads.emplace_back(largeRecordPusherMain<NonTemporal>, i, &barrier,
+                             buffers[i], &pushMetrics[i], &walkMetrics[i],
+                             &walkMisses[i]);
+    }
+
+    PerfUtils::Util::pinThreadToCore(BENCHMARK_THREADS);
+    pthread_barrier_wait(&barrier);
+
+    // Read every byte of each record as a real consumer would
+    uint64_t numConsumed = 0;
+    uint64_t consumeCycles = 0;
+    volatile uint64_t sum = 0;
+    while (numConsumed < totalPushes) {
+        for (int j = 0; j < BENCHMARK_THREADS; ++j) {
+            uint64_t bytesAvail;
+            char *data = buffers[j]->peek(&bytesAvail);
+            uint64_t records = bytesAvail/LARGE_RECORD_SIZE;
+            if (records == 0)
+                continue;
+
+            uint64_t start = PerfUtils::Cycles::rdtsc();
+            const uint64_t *words = reinterpret_cast<const uint64_t*>(data);
+            uint64_t localSum = 0;
+            for (uint64_t k = 0; k < records*LARGE_RECORD_SIZE/8; ++k)
+                localSum += words[k];
+            sum = sum + localSum;
+            consumeCycles += PerfUtils::Cycles::rdtsc() - start;
+
+            buffers[j]->consume(records*LARGE_RECORD_SIZE);
+            numConsumed += records;
+        }
+    }
+
+    for (auto &thread : threads)
+        thread.join();
+
+    Metrics pushTotals = {}, walkTotals = {};
+    uint64_t totalMisses = 0;
+    bool haveMisses = true;
+    for (int i = 0; i < BENCHMARK_THREADS; ++i) {
+        pushTotals.totalCycles += pushMetrics[i].totalCycles;
+        pushTotals.numOps += pushMetrics[i].numOps;
+        walkTotals.totalCycles += walkMetrics[i].totalCycles;
+        walkTotals.numOps += walkMetrics[i].numOps;
+        haveMisses &= (walkMisses[i] != ~0lu);
+        totalMisses += walkMisses[i];
+        delete buffers[i];
+    }
+
+    char missesPerWalk[32] = "n/a";
+    if (haveMisses)
+        snprintf(missesPerWalk, sizeof(missesPerWalk), "%0.2lf",
+                 double(totalMisses)/walkTotals.numOps);
+
+    printf("%-19s %10lu %15.2lf %15.2lf %15s %15.2lf\r\n",
+           testName,
+           totalPushes,
+           pushTotals.getAvgLatencyInNs(),
+           walkTotals.getAvgLatencyInNs(),
+           missesPerWalk,
+           PerfUtils::Cycles::toSeconds(consumeCycles)*1.0e9/totalPushes);
+}
+
+/**
+ * Runs the "Full" configuration with a consumer that publishes consumerPos
+ * only every ReleaseThreshold bytes. The producer's stalls show up in the
+ * push latency and its slow path count (each of which reads consumerPos),
+ * while the number of releases counts the consumerPos writes, i.e. the
+ * cache line transfers the batching is meant to save.
+ *
+ * \tparam ReleaseThreshold
+ *      See DeferredReleaseStagingBuffer
+ */
+template<uint64_t ReleaseThreshold>
+void runReleaseTest(const char *testName)
+{
+    using Buffer = Alternatives::DeferredReleaseStagingBuffer<ReleaseThreshold>;
+    const uint64_t totalPushes = BENCHMARK_THREADS*(ITERATIONS/BENCHMARK_THREADS);
+    pthread_barrier_t barrier;
+    if (pthread_barrier_init(&barrier, NULL, BENCHMARK_THREADS + 1)) {
+        printf("pthread error\r\n");
+    }
+
+    std::vector<std::thread> threads;
+    Buffer *buffers[BENCHMARK_THREADS];
+    Metrics pushMetrics[BENCHMARK_THREADS];
+    for (int i = 0; i < BENCHMARK_THREADS; ++i) {
+        buffers[i] = new Buffer(i);
+        threads.emplace_back(pusherMain<Buffer>, i,
+                             ITERATIONS/BENCHMARK_THREADS, &barrier,
+                             buffers[i], &doPushesTwoStage<Buffer>,
+                             &pushMetrics[i]);
+    }
+
+    PerfUtils::Util::pinThreadToCore(BENCHMARK_THREADS);
+    pthread_barrier_wait(&barrier);
+
+    Metrics popMetrics = {};
+    popMetrics.numOps = totalPushes;
+    uint64_t start = PerfUtils::Cycles::rdtsc();
+    doConsumesTwoStageBatched(totalPushes, buffers, BENCHMARK_THREADS);
+    popMetrics.totalCycles = PerfUtils::Cycles::rdtsc() - start;
+
+    for (auto &thread : threads)
+        thread.join();
+
+    Metrics pushTotals = {};
+    uint64_t releases = 0, starvedReleases = 0, slowPaths = 0;
+    for (int i = 0; i < BENCHMARK_THREADS; ++i) {
+        pushTotals.totalCycles += pushMetrics[i].totalCycles;
+        pushTotals.numOps += pushMetrics[i].numOps;
+        releases += buffers[i]->getNumReleases();
+        starvedReleases += buffers[i]->getNumStarvedReleases();
+        slowPaths += buffers[i]->numTimesProducerBlocked;
+        delete buffers[i];
+    }
+
+    printf("%-19s %10lu %15.2lf %15.2lf %10lu %10lu %10lu\r\n",
+           testName,
+           ReleaseThreshold,
+           popMetrics.getAvgLatencyInNs(),
+           pushTotals.getAvgLatencyInNs()/BENCHMARK_THREADS,
+           releases,
+           starvedReleases,
+           slowPaths);
+}
+
+/**
+ * Runs BENCHMARK_THREADS producers of timestamped entries and a consumer
+ * that measures how long the entries took to become visible to it, to
+ * show the latency cost of a producer that publishes its entries lazily.
+ */
+template<typename Buffer>
+void runVisibilityTest(const char *testName, void (*pushOp)(int,Buffer*))
+{
+    pthread_barrier_t barrier;
+    if (pthread_barrier_init(&barrier, NULL, BENCHMARK_THREADS + 1)) {
+        printf("pthread error\r\n");
+    }
+
+    std::vector<std::thread> threads;
+    Buffer *buffers[BENCHMARK_THREADS];
+    Metrics pushMetrics[BENCHMARK_THREADS];
+    for (int i = 0; i < BENCHMARK_THREADS; ++i) {
+        buffers[i] = new Buffer(i);
+        threads.emplace_back(pusherMain<Buffer>, i,
+                             ITERATIONS/BENCHMARK_THREADS, &barrier,
+                             buffers[i], pushOp, &pushMetrics[i]);
+    }
+
+    PerfUtils::Util::pinThreadToCore(BENCHMARK_THREADS);
+    pthread_barrier_wait(&barrier);
+
+    Metrics popMetrics = {};
+    popMetrics.numOps = BENCHMARK_THREADS*(ITERATIONS/BENCHMARK_THREADS);
+    uint64_t start = PerfUtils::Cycles::rdtsc();
+    doConsumesVisibility(popMetrics.numOps, buffers, BENCHMARK_THREADS);
+    popMetrics.totalCycles = PerfUtils::Cycles::rdtsc() - start;
+
+    for (auto &thread : threads)
+        thread.join();
+
+    Metrics pushTotals = {};
+    for (int i = 0; i < BENCHMARK_THREADS; ++i) {
+        pushTotals.totalCycles += pushMetrics[i].totalCycles;
+        pushTotals.numOps += pushMetrics[i].numOps;
+        delete buffers[i];
+    }
+
+    printf("%-19s %15.2lf %15.2lf %15.2lf %10lu\r\n",
+           testName,
+           popMetrics.getAvgLatencyInNs(),
+           pushTotals.getAvgLatencyInNs()/BENCHMARK_THREADS,
+           PerfUtils::Cycles::toSeconds(visibilityCycles)*1.0e9/
+                                                        popMetrics.numOps,
+           numRefills);
+}
+
+/**
+ * Event of the Disruptor pipeline benchmark. The producer fills in the
+ * record and each stage adds its results for the next one in place, so
+ * the record is never copied between queues.
+ */
+struct PipelineEvent {
+    // Timestamped entry as the producer would place it in a StagingBuffer
+    char record[entry_len];
+
+    // Set by the decode stage: timestamp relative to the previous event's
+    // in the same ring and the size of the record's arguments
+    uint64_t timestampDelta;
+    uint32_t argBytes;
+
+    // Set by the compress stage: the compressed entry and its size
+    uint32_t compressedBytes;
+    char compressed[datum_len + Log::MAX_PACKED_ENTRY_OVERHEAD];
+};
+
+// Disruptor ring with decode, compress and write stages
+using PipelineRing = Alternatives::DisruptorRing<PipelineEvent, 3>;
+enum PipelineStage { DECODE = 0, COMPRESS, WRITE, NUM_PIPELINE_STAGES };
+
+void doPushesPipeline(int iterations, PipelineRing *ring)
+{
+    for (int i = 0; i < iterations; ++i) {
+        auto *entry = reinterpret_cast<Log::UncompressedEntry*>(
+                                                    ring->claim()->record);
+        entry->timestamp = PerfUtils::Cycles::rdtsc();
+        entry->entrySize = entry_len;
+        std::memcpy(entry->argData, datum, datum_len);
+        ring->publish();
+    }
+}
+
+/**
+ * Decode stage: parses the records of the events [from, to) of a ring.
+ *
+ * \param[in,out] lastTimestamp
+ *      Timestamp of the ring's previous event
+ */
+void decodeEvents(PipelineRing *ring, uint64_t from, uint64_t to,
+                  uint64_t *lastTimestamp)
+{
+    for (uint64_t seq = from; seq < to; ++seq) {
+        PipelineEvent &ev = ring->get(seq);
+        auto *entry = reinterpret_cast<Log::UncompressedEntry*>(ev.record);
+        assert(entry->entrySize == entry_len);
+
+        ev.timestampDelta = entry->timestamp - *lastTimestamp;
+        ev.argBytes = entry->entrySize - sizeof(Log::UncompressedEntry);
+        *lastTimestamp = entry->timestamp;
+    }
+}
+
+// Compress stage: compresses the decoded events [from, to) of a ring
+void compressEvents(PipelineRing *ring, uint64_t from, uint64_t to)
+{
+    for (uint64_t seq = from; seq < to; ++seq) {
+        PipelineEvent &ev = ring->get(seq);
+        auto *entry = reinterpret_cast<Log::UncompressedEntry*>(ev.record);
+        ev.compressedBytes = Log::packEntry(ev.compressed, ev.timestampDelta,
+                                            entry->argData, ev.argBytes);
+    }
+}
+
+/**
+ * Write stage: gathers compressed events into chunks of the log file
+ * format and writes them to DEFAULT_LOG_FILE, so the output can be read
+ * back with the decompressor.
+ */
+class PipelineWriter {
+public:
+    PipelineWriter()
+        : fd(open(DEFAULT_LOG_FILE, FILE_PARAMS|O_TRUNC, 0666))
+        , buffer(static_cast<char*>(malloc(OUTPUT_BUFFER_SIZE)))
+        , writePos(buffer)
+    {
+        if (fd < 0) {
+            perror("Unable to open log file");
+            exit(1);
+        }
+
+        Log::FileHeader *header = reinterpret_cast<Log::FileHeader*>(buffer);
+        header->magic = Log::FILE_MAGIC;
+        header->cyclesPerSecond = PerfUtils::Cycles::getCyclesPerSec();
+        writePos += sizeof(Log::FileHeader);
+    }
+
+    ~PipelineWriter() {
+        flush();
+        close(fd);
+        free(buffer);
+    }
+
+    // Appends the compressed events [from, to) of a ring as one chunk
+    void
+    writeEvents(PipelineRing *ring, uint64_t from, uint64_t to) {
+        size_t maxBytes = sizeof(Log::ChunkHeader) +
+                          (to - from)*sizeof(PipelineEvent::compressed);
+        if (buffer + OUTPUT_BUFFER_SIZE - writePos < ptrdiff_t(maxBytes))
+            flush();
+
+        auto *chunk = reinterpret_cast<Log::ChunkHeader*>(writePos);
+        char *out = writePos + sizeof(Log::ChunkHeader);
+        for (uint64_t seq = from; seq < to; ++seq) {
+            PipelineEvent &ev = ring->get(seq);
+            std::memcpy(out, ev.compressed, ev.compressedBytes);
+            out += ev.compressedBytes;
+        }
+
+        PipelineEvent &first = ring->get(from);
+        PipelineEvent &last = ring->get(to - 1);
+        chunk->magic = Log::CHUNK_MAGIC;
+        chunk->bufferId = ring->getId();
+        chunk->numEntries = static_cast<uint32_t>(to - from);
+        chunk->length = static_cast<uint32_t>(out - writePos -
+                                              sizeof(Log::ChunkHeader));
+        chunk->firstTimestamp = reinterpret_cast<Log::UncompressedEntry*>(
+                            first.record)->timestamp - first.timestampDelta;
+        chunk->lastTimestamp = reinterpret_cast<Log::UncompressedEntry*>(
+                            last.record)->timestamp;
+        writePos = out;
+    }
+
+    void
+    flush() {
+        if (write(fd, buffer, writePos - buffer) < 0)
+            perror("Log file write failed");
+        writePos = buffer;
+    }
+
+private:
+    // Log file being written
+    int fd;
+
+    // Output buffer of OUTPUT_BUFFER_SIZE bytes and the position within
+    // it where the next chunk goes
+    char *buffer;
+    char *writePos;
+};
+
+/**
+ * Runs one stage of the pipeline over all the rings until it has processed
+ * totalEvents events.
+ */
+void pipelineStageMain(PipelineStage stage, PipelineRing **rings,
+                       int numRings, uint64_t totalEvents)
+{
+    PerfUtils::Util::pinThreadToCore(BENCHMARK_THREADS + stage);
+
+    std::vector<uint64_t> lastTimestamps(numRings, 0);
+    std::unique_ptr<PipelineWriter> writer;
+    if (stage == WRITE)
+        writer.reset(new PipelineWriter());
+
+    uint64_t numProcessed = 0;
+    while (numProcessed < totalEvents) {
+        for (int j = 0; j < numRings; ++j) {
+            uint64_t from = rings[j]->getSequence(stage);
+            uint64_t to = rings[j]->getAvailable(stage);
+            if (from == to)
+                continue;
+
+            if (stage == DECODE)
+                decodeEvents(rings[j], from, to, &lastTimestamps[j]);
+            else if (stage == COMPRESS)
+                compressEvents(rings[j], from, to);
+            else
+                writer->writeEvents(rings[j], from, to);
+
+            rings[j]->release(stage, to);
+            numProcessed += to - from;
+        }
+    }
+}
+
+/**
+ * Runs all three stages of the pipeline back to back in the calling
+ * thread, as the single NanoLog background thread would.
+ */
+void pipelineSingleThreadMain(PipelineRing **rings, int numRings,
+                              uint64_t totalEvents)
+{
+    std::vector<uint64_t> lastTimestamps(numRings, 0);
+    PipelineWriter writer;
+
+    uint64_t numProcessed = 0;
+    while (numProcessed < totalEvents) {
+        for (int j = 0; j < numRings; ++j) {
+            uint64_t from = rings[j]->getSequence(DECODE);
+            uint64_t to = rings[j]->getAvailable(DECODE);
+            if (from == to)
+                continue;
+
+            decodeEvents(rings[j], from, to, &lastTimestamps[j]);
+            rings[j]->release(DECODE, to);
+            compressEvents(rings[j], from, to);
+            rings[j]->release(COMPRESS, to);
+            writer.writeEvents(rings[j], from, to);
+            rings[j]->release(WRITE, to);
+            numProcessed += to - from;
+        }
+    }
+}
+
+/**
+ * Runs BENCHMARK_THREADS producers, each on its own DisruptorRing, and
+ * drains them through the decode, compress and write stages either in a
+ * single consumer thread or with one thread per stage.
+ */
+void runPipelineTest(const char *testName, bool pipelined)
+{
+    const uint64_t totalEvents = BENCHMARK_THREADS*(ITERATIONS/BENCHMARK_THREADS);
+    pthread_barrier_t barrier;
+    if (pthread_barrier_init(&barrier, NULL, BENCHMARK_THREADS + 1)) {
+        printf("pthread error\r\n");
+    }
+
+    std::vector<std::thread> threads;
+    PipelineRing *rings[BENCHMARK_THREADS];
+    Metrics pushMetrics[BENCHMARK_THREADS];
+    for (int i = 0; i < BENCHMARK_THREADS; ++i) {
+        rings[i] = new PipelineRing(i);
+        threads.emplace_back(pusherMain<PipelineRing>, i,
+                             ITERATIONS/BENCHMARK_THREADS, &barrier,
+                             rings[i], &doPushesPipeline, &pushMetrics[i]);
+    }
+
+    pthread_barrier_wait(&barrier);
+    uint64_t start = PerfUtils::Cycles::rdtsc();
+    if (pipelined) {
+        std::vector<std::thread> stages;
+        for (int stage = DECODE; stage < NUM_PIPELINE_STAGES; ++stage)
+            stages.emplace_back(pipelineStageMain, PipelineStage(stage),
+                                rings, BENCHMARK_THREADS, totalEvents);
+
+        for (auto &thread : stages)
+            thread.join();
+    } else {
+        PerfUtils::Util::pinThreadToCore(BENCHMARK_THREADS);
+        pipelineSingleThreadMain(rings, BENCHMARK_THREADS, totalEvents);
+    }
+    uint64_t stop = PerfUtils::Cycles::rdtsc();
+
+    for (auto &thread : threads)
+        thread.join();
+
+    Metrics pushTotals = {};
+    for (int i = 0; i < BENCHMARK_THREADS; ++i) {
+        pushTotals.totalCycles += pushMetrics[i].totalCycles;
+        pushTotals.numOps += pushMetrics[i].numOps;
+        delete rings[i];
+    }
+
+    printf("%-19s %10d %10lu %15.2lf %15.2lf\r\n",
+           testName,
+           pipelined ? int(NUM_PIPELINE_STAGES) : 1,
+           totalEvents,
+           totalEvents/PerfUtils::Cycles::toSeconds(stop - start)/1.0e6,
+           pushTotals.getAvgLatencyInNs()/BENCHMARK_THREADS);
+}
+
+/**
+ * Producer for runFairnessTest(): push()-es into the shared buffer until
+ * told to stop and reports how many of its pushes succeeded.
+ */
+template<typename Buffer>
+void fairnessPusherMain(int id, pthread_barrier_t *barrier, Buffer *sb,
+                        std::atomic<bool> *stop, uint64_t *numPushes)
+{
+    PerfUtils::Util::pinThreadToCore(id % std::thread::hardware_concurrency());
+    pthread_barrier_wait(barrier);
+
+    uint64_t pushes = 0;
+    while (!stop->load(std::memory_order_relaxed)) {
+        if (sb->push(datum, datum_len))
+            ++pushes;
+    }
+
+    *numPushes = pushes;
+}
+
+/**
+ * Consumer step for runFairnessTest(): pops whatever whole datums are
+ * available in the shared buffer.
+ */
+template<typename Buffer>
+void fairnessConsume(Buffer *sb)
+{
+    int bytesAvail;
+    sb->peek(bytesAvail);
+
+    if (bytesAvail >= int(datum_len))
+        sb->pop(bytesAvail - bytesAvail%datum_len);
+}
+
+// The lock-free MPSC buffer hands out one record at a time
+void fairnessConsume(Alternatives::MpscStagingBuffer *sb)
+{
+    uint32_t nbytes;
+    while (sb->front(&nbytes) != nullptr)
+        sb->pop();
+}
+
+/**
+ * Runs numThreads producers on a single shared buffer for
+ * FAIRNESS_DURATION_MS and reports the throughput along with how evenly
+ * the pushes were spread over the producers: the fewest and most pushes
+ * of any producer and Jain's fairness index, which is 1 when all producers
+ * pushed equally and 1/numThreads when one producer did all the pushes.
+ */
+template<typename Buffer>
+void runFairnessTest(const char *testName, int numThreads)
+{
+    pthread_barrier_t barrier;
+    if (pthread_barrier_init(&barrier, NULL, numThreads + 1)) {
+        printf("pthread error\r\n");
+    }
+
+    Buffer *sb = new Buffer(0);
+    std::atomic<bool> stop(false);
+    std::vector<uint64_t> numPushes(numThreads, 0);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i)
+        threads.emplace_back(fairnessPusherMain<Buffer>, i, &barrier, sb,
+                             &stop, &numPushes[i]);
+
+    PerfUtils::Util::pinThreadToCore(BENCHMARK_THREADS);
+    pthread_barrier_wait(&barrier);
+
+    uint64_t start = PerfUtils::Cycles::rdtsc();
+    uint64_t deadline = start + PerfUtils::Cycles::fromNanoseconds(
+                                            FAIRNESS_DURATION_MS*1000000UL);
+    while (PerfUtils::Cycles::rdtsc() < deadline)
+        fairnessConsume(sb);
+    stop = true;
+    uint64_t stopTime = PerfUtils::Cycles::rdtsc();
+
+    for (auto &thread : threads)
+        thread.join();
+    delete sb;
+
+    uint64_t total = 0, minPushes = ~0lu, maxPushes = 0;
+    double sumOfSquares = 0;
+    for (uint64_t pushes : numPushes) {
+        total += pushes;
+        minPushes = std::min(minPushes, pushes);
+        maxPushes = std::max(maxPushes, pushes);
+        sumOfSquares += double(pushes)*pushes;
+    }
+
+    double jainsIndex = (sumOfSquares == 0) ? 0 :
+                        double(total)*total/(numThreads*sumOfSquares);
+
+    printf("%-19s %10d %15.2lf %12lu %12lu %10.3lf\r\n",
+           testName,
+           numThreads,
+           total/PerfUtils::Cycles::toSeconds(stopTime - start)/1.0e6,
+           minPushes,
+           maxPushes,
+           jainsIndex);
+}
+
+// StagingBuffer types of the hierarchical aggregation benchmark: the
+// producers' buffers and the aggregators' node-local rings
+using HierarchyBuffer = Alternatives::StagingBuffer<64>;
+using HierarchyRing = Alternatives::StagingBuffer<64,
+                                                  Alternatives::SpacerLayout,
+                                                  AGGREGATION_RING_SIZE>;
+using HierarchyAggregator =
+        Alternatives::NodeAggregator<HierarchyBuffer, HierarchyRing>;
+
+/**
+ * Producer for runHierarchyTest(). It allocates its own StagingBuffer so
+ * that the memory lands on its NUMA node, publishes it and then pushes
+ * timestamped entries into it.
+ */
+void hierarchyPusherMain(int cpu, int iterations, pthread_barrier_t *barrier,
+                         HierarchyBuffer **sb, Metrics *m)
+{
+    PerfUtils::Util::pinThreadToCore(cpu);
+    *sb = new HierarchyBuffer(0);
+    pthread_barrier_wait(barrier);
+
+    uint64_t start = PerfUtils::Cycles::rdtsc();
+    doPushesTimestamped(iterations, *sb);
+    m->numOps = iterations;
+    m->totalCycles = PerfUtils::Cycles::rdtsc() - start;
+}
+
+/**
+ * Aggregator thread of a NUMA node for runHierarchyTest(). It drains the
+ * StagingBuffers of the producers on its node until it has moved all of
+ * their entries.
+ *
+ * \param sources
+ *      Slots that the producers on the node publish their buffers in
+ * \param[out] aggregator
+ *      Aggregator constructed on the node, for the consumer to read
+ */
+void aggregatorMain(int node, int cpu, pthread_barrier_t *barrier,
+                    std::vector<HierarchyBuffer**> sources,
+                    uint64_t numEntries,
+                    HierarchyAggregator **aggregator)
+{
+    PerfUtils::Util::pinThreadToCore(cpu);
+    *aggregator = new HierarchyAggregator(node);
+    pthread_barrier_wait(barrier);
+
+    for (HierarchyBuffer **sb : sources)
+        (*aggregator)->addSource(*sb);
+
+    uint64_t entriesMoved = 0;
+    while (entriesMoved < numEntries)
+        entriesMoved += (*aggregator)->drainOnce();
+}
+
+/**
+ * Runs HIERARCHY_PRODUCERS producers spread over the NUMA nodes and a
+ * consumer on node 0 that either reads every producer's StagingBuffer
+ * directly (the flat design) or only the rings of per-node aggregators.
+ * Besides the end-to-end throughput, it reports the bytes and buffer polls
+ * the consumer made to other nodes and, where hardware counters are
+ * available, its reads that missed in local memory.
+ */
+void runHierarchyTest(const char *testName, bool aggregated)
+{
+    const auto nodes = Alternatives::getCpusPerNumaNode();
+    const int numNodes = static_cast<int>(nodes.size());
+    const int perProducer = ITERATIONS/HIERARCHY_PRODUCERS;
+    const uint64_t totalEntries = uint64_t(HIERARCHY_PRODUCERS)*perProducer;
+
+    int numThreads = HIERARCHY_PRODUCERS + (aggregated ? numNodes : 0);
+    pthread_barrier_t barrier;
+    if (pthread_barrier_init(&barrier, NULL, numThreads + 1)) {
+        printf("pthread error\r\n");
+    }
+
+    // Producer i runs on node i % numNodes
+    std::vector<HierarchyBuffer*> buffers(HIERARCHY_PRODUCERS, nullptr);
+    std::vector<Metrics> pushMetrics(HIERARCHY_PRODUCERS);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < HIERARCHY_PRODUCERS; ++i) {
+        const std::vector<int> &cpus = nodes[i % numNodes];
+        int cpu = cpus[(i/numNodes) % cpus.size()];
+        threads.emplace_back(hierarchyPusherMain, cpu, perProducer, &barrier,
+                             &buffers[i], &pushMetrics[i]);
+    }
+
+    std::vector<HierarchyAggregator*> aggregators(numNodes, nullptr);
+    if (aggregated) {
+        for (int node = 0; node < numNodes; ++node) {
+            std::vector<HierarchyBuffer**> sources;
+            for (int i = node; i < HIERARCHY_PRODUCERS; i += numNodes)
+                sources.push_back(&buffers[i]);
+
+            threads.emplace_back(aggregatorMain, node, nodes[node].back(),
+                                 &barrier, sources,
+                                 uint64_t(sources.size())*perProducer,
+                                 &aggregators[node]);
+        }
+    }
+
+    PerfUtils::Util::pinThreadToCore(nodes[0][0]);
+    pthread_barrier_wait(&barrier);
+
+    PerfCounter nodeMisses = PerfCounter::nodeReadMisses();
+    nodeMisses.start();
+    uint64_t start = PerfUtils::Cycles::rdtsc();
+
+    // Consumes what's available in a producer's buffer or a ring that
+    // lives on the given node
+    uint64_t numConsumed = 0, remoteBytes = 0, remotePolls = 0;
+    auto consumeFrom = [&](auto *sb, int node) {
+        uint64_t bytesAvail;
+        sb->peek(&bytesAvail);
+        if (node != 0)
+            ++remotePolls;
+
+        if (bytesAvail < entry_len)
+            return;
+
+        // All the entries are entry_len bytes
+        uint64_t entries = bytesAvail/entry_len;
+        for (uint64_t i = 0; i < entries; ++i)
+            PerfUtils::Cycles::rdtsc();
+
+        sb->consume(entries*entry_len);
+        numConsumed += entries;
+        if (node != 0)
+            remoteBytes += entries*entry_len;
+    };
+
+    while (numConsumed < totalEntries) {
+        if (aggregated) {
+            for (int node = 0; node < numNodes; ++node)
+                consumeFrom(aggregators[node]->getRing(), node);
+        } else {
+            for (int i = 0; i < HIERARCHY_PRODUCERS; ++i)
+                consumeFrom(buffers[i], i % numNodes);
+        }
+    }
+
+    uint64_t stop = PerfUtils::Cycles::rdtsc();
+    uint64_t misses = nodeMisses.stop();
+
+    for (auto &thread : threads)
+        thread.join();
+
+    for (HierarchyBuffer *sb : buffers)
+        delete sb;
+    for (auto *aggregator : aggregators)
+        delete aggregator;
+
+    char missesStr[32] = "n/a";
+    if (nodeMisses.isValid())
+        snprintf(missesStr, sizeof(missesStr), "%lu", misses);
+
+    printf("%-19s %10d %10d %15.2lf %12.3lf %12lu %12s\r\n",
+           testName,
+           HIERARCHY_PRODUCERS,
+           numNodes,
+           totalEntries/PerfUtils::Cycles::toSeconds(stop - start)/1.0e6,
+           remoteBytes/1.0e6,
+           remotePolls,
+           missesStr);
+}
+
+// Registry of the hybrid per-thread/shared buffer benchmark
+using HybridRegistry = Alternatives::HybridStagingBufferRegistry<
+                                            Alternatives::StagingBuffer<64>>;
+
+/**
+ * Producer for runHybridTest(). Hot threads push() back to back while cold
+ * ones wait HYBRID_COLD_GAP_NS between pushes; either way, only the time
+ * spent in push() is counted.
+ *
+ * \param[out] m
+ *      Total pushes and cycles spent pushing
+ */
+void hybridPusherMain(bool hot, pthread_barrier_t *barrier, Metrics *m)
+{
+    const int pushes = hot ? HYBRID_HOT_PUSHES : HYBRID_COLD_PUSHES;
+    const uint64_t gapCycles = PerfUtils::Cycles::fromNanoseconds(
+                                                        HYBRID_COLD_GAP_NS);
+    pthread_barrier_wait(barrier);
+
+    for (int i = 0; i < pushes; ++i) {
+        uint64_t start = PerfUtils::Cycles::rdtsc();
+        HybridRegistry::push(datum, datum_len);
+        uint64_t stop = PerfUtils::Cycles::rdtsc();
+        m->totalCycles += stop - start;
+
+        if (!hot)
+            while (PerfUtils::Cycles::rdtsc() - stop < gapCycles);
+    }
+
+    m->numOps = pushes;
+}
+
+/**
+ * Runs numThreads unpinned producers, every HYBRID_HOT_STRIDE-th of them
+ * hot, through the hybrid registry with a consumer draining it, and reports
+ * how many dedicated buffers were handed out, the memory the buffers took
+ * and the push latency of the hot and the cold threads.
+ *
+ * \param maxDedicated
+ *      Cap on the number of dedicated buffers
+ * \param promoteAfterPushes
+ *      0 to hand the dedicated buffers to the first threads, otherwise
+ *      the push rate at which threads are promoted to one
+ */
+void runHybridTest(const char *testName, int numThreads, size_t maxDedicated,
+                   uint64_t promoteAfterPushes)
+{
+    HybridRegistry::configure(maxDedicated, promoteAfterPushes);
+
+    pthread_barrier_t barrier;
+    if (pthread_barrier_init(&barrier, NULL, numThreads + 1)) {
+        printf("pthread error\r\n");
+    }
+
+    uint64_t totalPushes = 0;
+    std::vector<Metrics> pushMetrics(numThreads);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < numThreads; ++i) {
+        bool hot = (i % HYBRID_HOT_STRIDE == 0);
+        totalPushes += hot ? HYBRID_HOT_PUSHES : HYBRID_COLD_PUSHES;
+        threads.emplace_back(hybridPusherMain, hot, &barrier,
+                             &pushMetrics[i]);
+    }
+
+    std::thread consumer([totalPushes]() {
+        auto process = [](char *data, uint64_t bytesAvail) {
+            uint64_t itemsConsumed = bytesAvail/datum_len;
+            for (uint64_t i = 0; i < itemsConsumed; ++i)
+                PerfUtils::Cycles::rdtsc();
+
+            return itemsConsumed*datum_len;
+        };
+
+        uint64_t numConsumed = 0;
+        while (numConsumed < totalPushes ||
+                                    HybridRegistry::getNumDedicated() > 0)
+            numConsumed += HybridRegistry::drain(process)/datum_len;
+    });
+
+    pthread_barrier_wait(&barrier);
+    for (auto &thread : threads)
+        thread.join();
+    consumer.join();
+
+    Metrics hot = {}, cold = {};
+    for (int i = 0; i < numThreads; ++i) {
+        Metrics &m = (i % HYBRID_HOT_STRIDE == 0) ? hot : cold;
+        m.numOps += pushMetrics[i].numOps;
+        m.totalCycles += pushMetrics[i].totalCycles;
+    }
+
+    printf("%-19s %10d %10lu %10lu %15.3lf %15.2lf %15.2lf\r\n",
+           testName,
+           numThreads,
+           HybridRegistry::getMaxNumDedicated(),
+           HybridRegistry::getNumPromotions(),
+           HybridRegistry::getPeakBytesAllocated()/1.0e6,
+           hot.getAvgLatencyInNs(),
+           cold.getAvgLatencyInNs());
+}
+
+/**
+ * Runs the push()/pop() benchmark of runTest() on the condition variable
+ * based buffers and also reports the number of times they notified a
+ * condition variable and, from getrusage() for the whole process, the
+ * number of voluntary context switches (i.e. waits that blocked) and the
+ * time spent in the kernel.
+ */
+template<typename Buffer>
+void runSignalTest(const char *testName, bool runIndividualBuffers)
+{
+    const int numBuffers = (runIndividualBuffers) ? BENCHMARK_THREADS : 1;
+    const uint64_t consumations =
+                        BENCHMARK_THREADS*(ITERATIONS/BENCHMARK_THREADS);
+
+    pthread_barrier_t barrier;
+    if (pthread_barrier_init(&barrier, NULL, BENCHMARK_THREADS + 1)) {
+        printf("pthread error\r\n");
+    }
+
+    std::vector<std::unique_ptr<Buffer>> buffers;
+    for (int i = 0; i < numBuffers; ++i)
+        buffers.emplace_back(new Buffer(i));
+
+    struct rusage before, after;
+    getrusage(RUSAGE_SELF, &before);
+
+    std::vector<std::thread> threads;
+    Metrics pushMetrics[BENCHMARK_THREADS];
+    for (int i = 0; i < BENCHMARK_THREADS; ++i)
+        threads.emplace_back(pusherMain<Buffer>, i,
+                             ITERATIONS/BENCHMARK_THREADS, &barrier,
+                             buffers[i % numBuffers].get(),
+                             &doPushesCond<Buffer>, &pushMetrics[i]);
+
+    std::vector<Buffer*> sbs;
+    for (auto &buffer : buffers)
+        sbs.push_back(buffer.get());
+
+    PerfUtils::Util::pinThreadToCore(BENCHMARK_THREADS);
+    pthread_barrier_wait(&barrier);
+    uint64_t start = PerfUtils::Cycles::rdtsc();
+    doConsumesCond(consumations, sbs.data(), numBuffers);
+    uint64_t stop = PerfUtils::Cycles::rdtsc();
+
+    for (auto &thread : threads)
+        thread.join();
+    getrusage(RUSAGE_SELF, &after);
+
+    Metrics pushTotals = {};
+    for (int i = 0 ; i < BENCHMARK_THREADS; ++i) {
+        pushTotals.totalCycles += pushMetrics[i].totalCycles;
+        pushTotals.numOps += pushMetrics[i].numOps;
+    }
+
+    uint64_t numNotifies = 0;
+    for (auto &buffer : buffers)
+        numNotifies += buffer->numNotifies;
+
+    double sysMs = (after.ru_stime.tv_sec - before.ru_stime.tv_sec)*1.0e3 +
+                   (after.ru_stime.tv_usec - before.ru_stime.tv_usec)/1.0e3;
+
+    printf("%-19s %10s %10lu %15.2lf %15.2lf %10lu %10ld %10.2lf\r\n",
+           testName,
+           runIndividualBuffers ? "false" : "true",
+           consumations,
+           PerfUtils::Cycles::toSeconds(stop - start)*1.0e9/consumations,
+           pushTotals.getAvgLatencyInNs()/BENCHMARK_THREADS,
+           numNotifies,
+           after.ru_nvcsw - before.ru_nvcsw,
+           sysMs);
+}
+
+/**
+ * Counts the instructions the producer and the consumer of a single
+ * StagingBuffer execute per record. To keep the consumer from being
+ * charged for spinning on an empty buffer, one thread alternates between
+ * push()-ing a quarter of the buffer's worth of records and consuming them
+ * all, with a counter enabled for each phase. The records are cache-hot,
+ * so the latencies reported are the best case.
+ */
+template<typename Buffer>
+void runInstructionTest(const char *testName,
+                        void (*consumeOp)(int,Buffer**,int))
+{
+    const int recordsPerRound = STAGING_BUFFER_SIZE/(4*datum_len);
+    const int numRounds = ITERATIONS/recordsPerRound;
+    const uint64_t numRecords = uint64_t(numRounds)*recordsPerRound;
+
+    Buffer *sb = new Buffer(0);
+    PerfCounter pushInstructions = PerfCounter::instructions();
+    PerfCounter consumeInstructions = PerfCounter::instructions();
+
+    uint64_t pushCycles = 0, consumeCycles = 0;
+    uint64_t pushCount = 0, consumeCount = 0;
+    for (int round = 0; round < numRounds; ++round) {
+        pushInstructions.start();
+        uint64_t start = PerfUtils::Cycles::rdtsc();
+        doPushesTwoStage(recordsPerRound, sb);
+        uint64_t stop = PerfUtils::Cycles::rdtsc();
+        pushCount += pushInstructions.stop();
+        pushCycles += stop - start;
+
+        consumeInstructions.start();
+        start = PerfUtils::Cycles::rdtsc();
+        consumeOp(recordsPerRound, &sb, 1);
+        stop = PerfUtils::Cycles::rdtsc();
+        consumeCount += consumeInstructions.stop();
+        consumeCycles += stop - start;
+    }
+    delete sb;
+
+    char pushStr[32] = "n/a", consumeStr[32] = "n/a";
+    if (pushInstructions.isValid())
+        snprintf(pushStr, sizeof(pushStr), "%.2lf",
+                 double(pushCount)/numRecords);
+    if (consumeInstructions.isValid())
+        snprintf(consumeStr, sizeof(consumeStr), "%.2lf",
+                 double(consumeCount)/numRecords);
+
+    printf("%-19s %10lu %15.2lf %15.2lf %15s %15s\r\n",
+           testName,
+           numRecords,
+           PerfUtils::Cycles::toSeconds(pushCycles)*1.0e9/numRecords,
+           PerfUtils::Cycles::toSeconds(consumeCycles)*1.0e9/numRecords,
+           pushStr,
+           consumeStr);
+}
+
+int main(int argc, char** argv) {
+    constexpr uint64_t numOps = BENCHMARK_THREADS*(ITERATIONS/BENCHMARK_THREADS);
+    char hostname[256];
+    if (gethostname(hostname, 256))
+        bzero(hostname, 256); // Null out the string if an error occurs
+
+    printf("# Benchmarks the NanoLog StagingBuffer with certain optimizations "
+           "disabled.\r\n"
+           "# It mocks the NanoLog operations by utilizing multiple threads to"
+           " push fixed\r\n"
+           "# size data to a buffer and a separate thread to pop them back out."
+           "\r\n"
+           "# The average operation time is reported.\r\n"
+           "#\r\n"
+           "# - Configuration -\r\n"
+           "# Number of push operations: %0.2lf KOps\r\n"
+           "# Number of threads: %d\r\n"
+           "# Datum: \"%s\"\r\n"
+           "# Datum size: %ld Bytes\r\n"
+           "# Staging Buffer Size: %0.3lf KB\r\n"
+           "# Benchmark machine hostname: %s",
+           numOps/1.0e3,
+           BENCHMARK_THREADS,
+           datum,
+           datum_len,
+           NanoLogConfig::STAGING_BUFFER_SIZE/1.0e3,
+           hostname);
+
+    printf("\r\n\r\n# %-18s %10s %10s %15s %15s\r\n",
+            "Condition", "Global", "Num Ops", "Consume (ns)", "Push Avg (ns)");
+
+    runTest<StagingBuffers::Basic>("Basic", true, &doPushes, &doConsumes);
+    runTest<StagingBuffers::Basic>("Basic", false, &doPushes, &doConsumes);
+    runTest<StagingBuffers::TwoLockQueue<datum_len>>("Two-Lock Queue", true, &doPushes, &doConsumes);
+    runTest<StagingBuffers::TwoLockQueue<datum_len>>("Two-Lock Queue", false, &doPushes, &doConsumes);
+    runTest<StagingBuffers::StdDeque<datum_len>>("Deque", true, &doPushes, &doConsumes);
+    runTest<StagingBuffers::StdDeque<datum_len>>("Deque", false, &doPushes, &doConsumes);
+    runTest<StagingBuffers::SignalPoll>("Signaler", true, &doPushesCond, &doConsumesCond);
+    runTest<StagingBuffers::SignalPoll>("Signaler", false, &doPushesCond, &doConsumesCond);
     runTest<StagingBuffers::BasicSpinLock>("BasicSpinLock", true, &doPushes, &doConsumes);
     runTest<StagingBuffers::BasicSpinLock>("BasicSpinLock", false, &doPushes, &doConsumes);
+    runTest<StagingBuffers::Basic>("Basic Staged x2", false, &doPushesStaged<StagingBuffers::Basic, 2>, &doConsumes);
+    runTest<StagingBuffers::Basic>("Basic pushv x2", false, &doPushesVectored<StagingBuffers::Basic, 2>, &doConsumes);
+    runTest<StagingBuffers::Basic>("Basic pushv<2>", false, &doPushesVectoredFixed<StagingBuffers::Basic, 2>, &doConsumes);
+    runTest<StagingBuffers::Basic>("Basic Staged x4", false, &doPushesStaged<StagingBuffers::Basic, 4>, &doConsumes);
+    runTest<StagingBuffers::Basic>("Basic pushv x4", false, &doPushesVectored<StagingBuffers::Basic, 4>, &doConsumes);
+    runTest<StagingBuffers::Basic>("Basic pushv<4>", false, &doPushesVectoredFixed<StagingBuffers::Basic, 4>, &doConsumes);
+    runTest<StagingBuffers::Basic>("Basic Staged x8", false, &doPushesStaged<StagingBuffers::Basic, 8>, &doConsumes);
+    runTest<StagingBuffers::Basic>("Basic pushv x8", false, &doPushesVectored<StagingBuffers::Basic, 8>, &doConsumes);
+    runTest<StagingBuffers::Basic>("Basic pushv<8>", false, &doPushesVectoredFixed<StagingBuffers::Basic, 8>, &doConsumes);
+    runTest<StagingBuffers::Basic>("Basic 2Stage", true, &doPushesLockedTwoStage, &doConsumes);
+    runTest<StagingBuffers::Basic>("Basic 2Stage", false, &doPushesLockedTwoStage, &doConsumes);
+    runTest<StagingBuffers::Basic>("Basic Reserve Only", true, &doPushesLockedReserveOnly, &doConsumes);
+    runTest<StagingBuffers::Basic>("Basic Reserve Only", false, &doPushesLockedReserveOnly, &doConsumes);
+    runTest<StagingBuffers::BasicSpinLock>("SpinLock 2Stage", true, &doPushesLockedTwoStage, &doConsumes);
+    runTest<StagingBuffers::BasicSpinLock>("SpinLock 2Stage", false, &doPushesLockedTwoStage, &doConsumes);
+    runTest<StagingBuffers::BasicSpinLock>("SpinLock Rsv Only", true, &doPushesLockedReserveOnly, &doConsumes);
+    runTest<StagingBuffers::BasicSpinLock>("SpinLock Rsv Only", false, &doPushesLockedReserveOnly, &doConsumes);
     runTest<Alternatives::StagingBuffer<0>>("Full No Batch/FS", true, &doPushesTwoStage, &doConsumesTwoStage);
     runTest<Alternatives::StagingBuffer<0>>("Full False Sharing", true, &doPushesTwoStage, &doConsumesTwoStageBatched);
     runTest<Alternatives::StagingBuffer<64>>("Full No Batched", true, &doPushesTwoStage, &doConsumesTwoStage);
     runTest<Alternatives::StagingBuffer<64>>("Full", true, &doPushesTwoStage, &doConsumesTwoStageBatched);
-}
\ No newline at end of file
+    runTest<Alternatives::FastForwardQueue<datum_len>>("Full FastForward", true, &doPushes, &doConsumesSlots);
+    runTest<Alternatives::SequenceStagingBuffer>("Full Sequence", true, &doPushesTwoStage, &doConsumesFramed);
+    runTest<Alternatives::StagingBuffer<64>>("Layout Spacer", true, &doPushesTwoStage, &doConsumesTwoStageBatched);
+    runTest<Alternatives::StagingBuffer<0, Alternatives::PaddedFieldsLayout<64>>>("Layout Padded", true, &doPushesTwoStage, &doConsumesTwoStageBatched);
+    runTest<Alternatives::StagingBuffer<0, Alternatives::GroupedLayout<64>>>("Layout Grouped", true, &doPushesTwoStage, &doConsumesTwoStageBatched);
+    runTest<Alternatives::StagingBuffer<0, Alternatives::GroupedLayout<128>>>("Layout Grouped 128", true, &doPushesTwoStage, &doConsumesTwoStageBatched);
+    runTest<Alternatives::StagingBuffer<0, Alternatives::InterferenceLayout>>("Layout Interference", true, &doPushesTwoStage, &doConsumesTwoStageBatched);
+    runTest<Alternatives::StagingBuffer<64>>("Full Txn 1", true, &doPushesBatched<Alternatives::StagingBuffer<64>, 1>, &doConsumesTwoStageBatched);
+    runTest<Alternatives::StagingBuffer<64>>("Full Txn 2", true, &doPushesBatched<Alternatives::StagingBuffer<64>, 2>, &doConsumesTwoStageBatched);
+    runTest<Alternatives::StagingBuffer<64>>("Full Txn 4", true, &doPushesBatched<Alternatives::StagingBuffer<64>, 4>, &doConsumesTwoStageBatched);
+    runTest<Alternatives::StagingBuffer<64>>("Full Txn 8", true, &doPushesBatched<Alternatives::StagingBuffer<64>, 8>, &doConsumesTwoStageBatched);
+    runTest<Alternatives::StagingBuffer<64>>("Full Txn 16", true, &doPushesBatched<Alternatives::StagingBuffer<64>, 16>, &doConsumesTwoStageBatched);
+    runTest<Alternatives::StagingBuffer<64>>("Full Txn 32", true, &doPushesBatched<Alternatives::StagingBuffer<64>, 32>, &doConsumesTwoStageBatched);
+    runTest<Alternatives::StagingBuffer<64>>("Full Txn 64", true, &doPushesBatched<Alternatives::StagingBuffer<64>, 64>, &doConsumesTwoStageBatched);
+    runTest<Alternatives::StagingBuffer<64>>("Full Compressed", true, &doPushesTimestamped, &doConsumesCompressed);
+    runTest<Alternatives::StagingBuffer<64>>("Full Timestamped", true, &doPushesTimestamped, &doConsumesTimestampedBatched);
+    runTest<Alternatives::StagingBuffer<64>>("Full Encoded", true, &doPushesEncoded, &doConsumesTimestampedBatched);
+    runTest<Alternatives::StagingBuffer<64>>("Full Ordered 1us", true, &doPushesTimestamped, &doConsumesOrdered<Alternatives::StagingBuffer<64>, 1000>);
+    runTest<Alternatives::StagingBuffer<64>>("Full Ordered 10us", true, &doPushesTimestamped, &doConsumesOrdered<Alternatives::StagingBuffer<64>, 10000>);
+
+    printf("\r\n\r\n# Multiple consumers sharding the producer buffers with "
+           "work stealing\r\n");
+    printf("# %-18s %10s %10s %15s %15s %10s\r\n",
+           "Consumers", "Producers", "Num Ops", "Consume (Mops)",
+           "Push Avg (ns)", "Steals");
+    for (int numConsumers = 1; numConsumers <= 8; numConsumers *= 2)
+        runMultiConsumerTest<Alternatives::StagingBuffer<64>>(
+                                        MULTI_CONSUMER_PRODUCERS, numConsumers);
+
+    printf("\r\n\r\n# Short-lived threads logging through the StagingBuffer "
+           "registry (%d pushes per thread)\r\n", CHURN_PUSHES_PER_THREAD);
+    printf("# %-18s %10s %10s %15s %15s %15s %10s %10s\r\n",
+           "Condition", "Threads", "Num Ops", "Total/Op (ns)",
+           "First Log (ns)", "Lifetime (us)", "Peak Bufs", "Allocated");
+    runThreadChurnTest<Alternatives::StagingBufferRegistry<
+                        Alternatives::StagingBuffer<64>, false>>("Registry");
+    runThreadChurnTest<Alternatives::StagingBufferRegistry<
+                        Alternatives::StagingBuffer<64>, true>>("Registry Pooled");
+
+    printf("\r\n\r\n# Bursty producers (%d bursts of %0.3lf KB, %u us apart)"
+           " on fixed rings vs. segmented buffers\r\n",
+           NUM_BURSTS, BURST_BYTES/1.0e3, BURST_IDLE_US);
+    printf("# %-18s %10s %15s %15s %15s %15s\r\n",
+           "Condition", "Num Ops", "Push Avg (ns)", "Max Burst (us)",
+           "Blocked (us)", "Memory (MB)");
+    {
+        Alternatives::StagingBuffer<64> *rings[BENCHMARK_THREADS];
+        for (int i = 0; i < BENCHMARK_THREADS; ++i)
+            rings[i] = new Alternatives::StagingBuffer<64>(i);
+
+        // The fixed ring only times its stalls with RECORD_PRODUCER_STATS
+#ifdef RECORD_PRODUCER_STATS
+        const bool ringCountsBlocking = true;
+#else
+        const bool ringCountsBlocking = false;
+#endif
+        runBurstTest("Fixed Ring", rings, []() -> uint64_t {
+            return uint64_t(BENCHMARK_THREADS)*STAGING_BUFFER_SIZE;
+        }, ringCountsBlocking);
+
+        for (int i = 0; i < BENCHMARK_THREADS; ++i)
+            delete rings[i];
+    }
+    {
+        static Alternatives::SegmentPool pool;
+        Alternatives::SegmentedStagingBuffer *segmented[BENCHMARK_THREADS];
+        for (int i = 0; i < BENCHMARK_THREADS; ++i)
+            segmented[i] = new Alternatives::SegmentedStagingBuffer(i, &pool);
+
+        runBurstTest("Segmented", segmented, []() -> uint64_t {
+            return pool.getBytesAllocated();
+        }, true);
+
+        for (int i = 0; i < BENCHMARK_THREADS; ++i)
+            delete segmented[i];
+    }
+
+    printf("\r\n\r\n# %d unpinned threads on per-CPU buffers (rseq) vs. "
+           "per-thread buffers (%d pushes per thread)\r\n",
+           PER_CPU_THREADS, PER_CPU_PUSHES_PER_THREAD);
+    printf("# %-18s %10s %10s %15s %15s %15s %10s\r\n",
+           "Condition", "Threads", "Num Ops", "Consume (Mops)",
+           "Push Avg (ns)", "Memory (MB)", "Restarts");
+    runPerCpuTest();
+
+    printf("\r\n\r\n# Consumer prefetching the next buffer's control "
+           "variables and the data ahead (distances in buffers/lines)\r\n");
+    printf("# %-18s %10s %10s %15s %15s\r\n",
+           "Condition", "Buffers", "Num Ops", "Consume (ns)", "Push Avg (ns)");
+    {
+        using Buffer = Alternatives::StagingBuffer<64>;
+        for (int numBuffers = 2; numBuffers <= 256; numBuffers *= 2) {
+            runPrefetchTest<Buffer>("Batched", numBuffers,
+                                    &doConsumesTwoStageBatched);
+            runPrefetchTest<Buffer>("Read No Prefetch", numBuffers,
+                                    &doConsumesPrefetched<Buffer, 0, 0>);
+            runPrefetchTest<Buffer>("Prefetch 1/4", numBuffers,
+                                    &doConsumesPrefetched<Buffer, 1, 4>);
+            runPrefetchTest<Buffer>("Prefetch 2/8", numBuffers,
+                                    &doConsumesPrefetched<Buffer, 2, 8>);
+            runPrefetchTest<Buffer>("Prefetch 4/16", numBuffers,
+                                    &doConsumesPrefetched<Buffer, 4, 16>);
+        }
+    }
+
+    printf("\r\n\r\n# %u byte records copied through the cache vs. with "
+           "non-temporal stores (%u KB producer working set)\r\n",
+           LARGE_RECORD_SIZE, PRODUCER_WORKING_SET/1024);
+    printf("# %-18s %10s %15s %15s %15s %15s\r\n",
+           "Condition", "Num Ops", "Push Avg (ns)", "WS Walk (ns)",
+           "WS L1D Misses", "Consume (ns)");
+    runLargeRecordTest<false>("Cached Copy");
+    runLargeRecordTest<true>("Non-Temporal");
+
+    printf("\r\n\r\n# Consumer releasing consumed space to the producer in "
+           "batches of at least Threshold bytes\r\n");
+    printf("# %-18s %10s %15s %15s %10s %10s %10s\r\n",
+           "Condition", "Threshold", "Consume (ns)", "Push Avg (ns)",
+           "Releases", "Starved", "Slow Paths");
+    runReleaseTest<0>("Release Always");
+    runReleaseTest<256>("Release Batched");
+    runReleaseTest<4*1024>("Release Batched");
+    runReleaseTest<64*1024>("Release Batched");
+    runReleaseTest<RELEASE_THRESHOLD>("Release Config");
+
+    printf("\r\n\r\n# Producer publishing its entries lazily every N "
+           "records/bytes or after a deadline\r\n");
+    printf("# %-18s %15s %15s %15s %10s\r\n",
+           "Condition", "Consume (ns)", "Push Avg (ns)", "Visible (ns)",
+           "Refills");
+    runVisibilityTest<Alternatives::StagingBuffer<64>>("Full",
+            &doPushesTimestamped);
+    runVisibilityTest<Alternatives::LazyPublishStagingBuffer<4, 0, 0>>(
+            "Lazy 4 Records", &doPushesTimestampedLazy);
+    runVisibilityTest<Alternatives::LazyPublishStagingBuffer<16, 0, 0>>(
+            "Lazy 16 Records", &doPushesTimestampedLazy);
+    runVisibilityTest<Alternatives::LazyPublishStagingBuffer<64, 0, 0>>(
+            "Lazy 64 Records", &doPushesTimestampedLazy);
+    runVisibilityTest<Alternatives::LazyPublishStagingBuffer<0, 4096, 0>>(
+            "Lazy 4 KB", &doPushesTimestampedLazy);
+    runVisibilityTest<Alternatives::LazyPublishStagingBuffer<0, 0, 1000>>(
+            "Lazy 1 us", &doPushesTimestampedLazy);
+    runVisibilityTest<Alternatives::LazyPublishStagingBuffer<>>(
+            "Lazy Config", &doPushesTimestampedLazy);
+
+    printf("\r\n\r\n# Decode, compress and write stages over a Disruptor "
+           "ring in one consumer thread vs. one thread per stage\r\n");
+    printf("# %-18s %10s %10s %15s %15s\r\n",
+           "Condition", "Consumers", "Num Ops", "Consume (Mops)",
+           "Push Avg (ns)");
+    runPipelineTest("Single Thread", false);
+    runPipelineTest("Pipelined", true);
+
+    printf("\r\n\r\n# Producers sharing one buffer guarded by different "
+           "locks for %u ms\r\n", FAIRNESS_DURATION_MS);
+    printf("# %-18s %10s %15s %12s %12s %10s\r\n",
+           "Lock", "Threads", "Push (Mops)", "Min Pushes", "Max Pushes",
+           "Jain");
+    for (int threads = 2; threads <= FAIRNESS_MAX_THREADS; threads *= 2) {
+        using namespace StagingBuffers;
+        runFairnessTest<BasicLocked<std::mutex>>("std::mutex", threads);
+        runFairnessTest<BasicLocked<Locks::TasLock>>("Test-and-Set", threads);
+        runFairnessTest<BasicLocked<Locks::TicketLock>>("Ticket", threads);
+        runFairnessTest<BasicLocked<Locks::McsLock>>("MCS", threads);
+        runFairnessTest<BasicLocked<Locks::ClhLock>>("CLH", threads);
+        runFairnessTest<BasicLocked<Locks::PthreadSpinLock>>(
+                                                "pthread_spinlock", threads);
+        runFairnessTest<BasicSpinLock>("BasicSpinLock", threads);
+        runFairnessTest<FlatCombining>("Flat Combining", threads);
+        runFairnessTest<Alternatives::MpscStagingBuffer>("Lock-free MPSC",
+                                                         threads);
+    }
+
+    printf("\r\n\r\n# Consumer on node 0 reading every producer's buffer "
+           "vs. per-NUMA node aggregated rings\r\n");
+    printf("# %-18s %10s %10s %15s %12s %12s %12s\r\n",
+           "Condition", "Producers", "Nodes", "Consume (Mops)",
+           "Remote (MB)", "Remote Polls", "Node Misses");
+    runHierarchyTest("Flat", false);
+    runHierarchyTest("Aggregated", true);
+
+    printf("\r\n\r\n# 1 in %d threads hot (%d pushes) and the rest cold "
+           "(%d pushes %u ns apart) on per-thread\r\n"
+           "# buffers vs. at most %d dedicated buffers plus %u shared MPSC "
+           "buffers\r\n",
+           HYBRID_HOT_STRIDE, HYBRID_HOT_PUSHES, HYBRID_COLD_PUSHES,
+           HYBRID_COLD_GAP_NS, HYBRID_DEDICATED_BUFFERS,
+           HYBRID_SHARED_BUFFERS);
+    printf("# %-18s %10s %10s %10s %15s %15s %15s\r\n",
+           "Condition", "Threads", "Dedicated", "Promoted", "Memory (MB)",
+           "Hot Push (ns)", "Cold Push (ns)");
+    for (int threads = 64; threads <= 1024; threads *= 4) {
+        runHybridTest("Per-Thread", threads, SIZE_MAX, 0);
+        runHybridTest("Shared Only", threads, 0, 0);
+        runHybridTest("Hybrid First N", threads, HYBRID_DEDICATED_BUFFERS, 0);
+        runHybridTest("Hybrid Hottest", threads, HYBRID_DEDICATED_BUFFERS,
+                      HYBRID_PROMOTE_PUSHES);
+    }
+
+    printf("\r\n\r\n# Condition variables notified on every push()/pop() "
+           "vs. only when a waiter may proceed\r\n");
+    printf("# %-18s %10s %10s %15s %15s %10s %10s %10s\r\n",
+           "Condition", "Global", "Num Ops", "Consume (ns)", "Push Avg (ns)",
+           "Notifies", "Vol Ctx Sw", "Sys (ms)");
+    runSignalTest<StagingBuffers::SignalPoll>("Signaler", true);
+    runSignalTest<StagingBuffers::SignalPoll>("Signaler", false);
+    runSignalTest<StagingBuffers::SignalOnTransition>("Signal Transitions",
+                                                      true);
+    runSignalTest<StagingBuffers::SignalOnTransition>("Signal Transitions",
+                                                      false);
+
+    printf("\r\n\r\n# Positions as pointers with a shared end of recorded "
+           "space vs. masked 64-bit sequences\r\n"
+           "# with skip records, in one thread alternating push()-es and "
+           "consumes\r\n");
+    printf("# %-18s %10s %15s %15s %15s %15s\r\n",
+           "Condition", "Num Ops", "Push (ns)", "Consume (ns)",
+           "Push Instrs", "Consume Instrs");
+    runInstructionTest<Alternatives::StagingBuffer<64>>("Full",
+            &doConsumesTwoStageBatched);
+    runInstructionTest<Alternatives::SequenceStagingBuffer>("Sequence",
+            &doConsumesFramed);
+}